@@ -0,0 +1,147 @@
+#ifndef ALGORITHM_ALLOCATIONCOUNTER_H_
+#define ALGORITHM_ALLOCATIONCOUNTER_H_ 1
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+/** \brief  Allocations of the whole process
+
+    Every replaceable operator new and operator delete is replaced,
+    so that each allocation is counted, and its bytes added up, on the way to malloc.
+    The replacements are definitions; include this into one translation unit of the program only.
+*/
+static std::atomic<size_t> alloc_count(0);
+static std::atomic<size_t> alloc_bytes(0);
+
+/** Counts one allocation, and takes it from malloc; nullptr when out of memory */
+static void *
+Allocate(size_t size)
+{
+    ++alloc_count;
+    alloc_bytes += size;
+
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+/** Hands an allocation back to free, out of line so that the compiler does not pair free with operator new */
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+static void
+Deallocate(void * ptr) noexcept
+{ std::free(ptr); }
+
+void *
+operator new(size_t size)
+{
+    void * ptr = Allocate(size);
+    if(ptr == nullptr)
+        throw std::bad_alloc();
+
+    return ptr;
+}
+
+void *
+operator new[](size_t size)
+{ return operator new(size); }
+
+void *
+operator new(size_t size, const std::nothrow_t &) noexcept
+{ return Allocate(size); }
+
+void *
+operator new[](size_t size, const std::nothrow_t &) noexcept
+{ return Allocate(size); }
+
+void
+operator delete(void * ptr) noexcept
+{ Deallocate(ptr); }
+
+void
+operator delete[](void * ptr) noexcept
+{ Deallocate(ptr); }
+
+void
+operator delete(void * ptr, size_t) noexcept
+{ Deallocate(ptr); }
+
+void
+operator delete[](void * ptr, size_t) noexcept
+{ Deallocate(ptr); }
+
+void
+operator delete(void * ptr, const std::nothrow_t &) noexcept
+{ Deallocate(ptr); }
+
+void
+operator delete[](void * ptr, const std::nothrow_t &) noexcept
+{ Deallocate(ptr); }
+
+#if defined(__cpp_aligned_new)
+/** Counts one over-aligned allocation; nullptr when out of memory */
+static void *
+Allocate(size_t size, std::align_val_t align)
+{
+    size_t alignment = std::max(static_cast<size_t>(align), sizeof(void *));
+    void * ptr = nullptr;
+
+    ++alloc_count;
+    alloc_bytes += size;
+
+    if(posix_memalign(&ptr, alignment, size == 0 ? 1 : size) != 0)
+        return nullptr;
+
+    return ptr;
+}
+
+void *
+operator new(size_t size, std::align_val_t align)
+{
+    void * ptr = Allocate(size, align);
+    if(ptr == nullptr)
+        throw std::bad_alloc();
+
+    return ptr;
+}
+
+void *
+operator new[](size_t size, std::align_val_t align)
+{ return operator new(size, align); }
+
+void *
+operator new(size_t size, std::align_val_t align, const std::nothrow_t &) noexcept
+{ return Allocate(size, align); }
+
+void *
+operator new[](size_t size, std::align_val_t align, const std::nothrow_t &) noexcept
+{ return Allocate(size, align); }
+
+void
+operator delete(void * ptr, std::align_val_t) noexcept
+{ Deallocate(ptr); }
+
+void
+operator delete[](void * ptr, std::align_val_t) noexcept
+{ Deallocate(ptr); }
+
+void
+operator delete(void * ptr, size_t, std::align_val_t) noexcept
+{ Deallocate(ptr); }
+
+void
+operator delete[](void * ptr, size_t, std::align_val_t) noexcept
+{ Deallocate(ptr); }
+
+void
+operator delete(void * ptr, std::align_val_t, const std::nothrow_t &) noexcept
+{ Deallocate(ptr); }
+
+void
+operator delete[](void * ptr, std::align_val_t, const std::nothrow_t &) noexcept
+{ Deallocate(ptr); }
+#endif
+
+#endif /** ! ALGORITHM_ALLOCATIONCOUNTER_H_ */
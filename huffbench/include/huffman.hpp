@@ -0,0 +1 @@
+../../libhuffman/lib/huffman.hpp
\ No newline at end of file
@@ -0,0 +1,912 @@
+#include "huffman.hpp"
+#include "allocationcounter.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <streambuf>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+
+#include <getopt.h>
+#include <sys/resource.h>
+
+using namespace algorithm;
+
+/** Output stream buffer that only counts the bytes, so that the sink allocates nothing */
+class CountStreamBuffer : public std::streambuf
+{
+private:
+    size_t count_;
+
+protected:
+    int_type
+    overflow(int_type ch)
+    {
+        ++count_;
+        return traits_type::not_eof(ch);
+    }
+
+    std::streamsize
+    xsputn(const char *, std::streamsize len)
+    {
+        count_ += size_t(len);
+        return len;
+    }
+
+public:
+    CountStreamBuffer(void)
+    : count_    (0)
+    {}
+
+    size_t
+    Count(void)
+    const
+    { return count_; }
+};
+
+struct Msg
+{
+    static void
+    Usage(std::ostream & out, const std::string & this_file)
+    {
+        out << "Usage: " << this_file << " [OPTION]... [FILENAME]...\n"
+            << "Compress and decompress synthetic corpora, and each FILENAME, in memory,\n"
+            << "and print the speed, ratio, peak memory and time of each phase as JSON.\n"
+            << "With --messages, --message-size or --codebook, many small synthetic messages\n"
+            << "are coded with one coder instead, and the allocations and time per message printed.\n"
+            << "\n"
+            << "Options:\n"
+            << "  -h,  --help                      print this help\n"
+            << "  -c,  --corpus=NAME               add the synthetic corpus NAME; random, zipf, sensor, text or records\n"
+            << "                                   (default is all of them, unless a FILENAME is given)\n"
+            << "  -S,  --size=BYTES                bytes of each synthetic corpus (default is 8388608)\n"
+            << "  -r,  --repeat=N                  code each corpus N times, and keep the fastest (default is 5)\n"
+            << "  -o,  --output-file=FILENAME      write the JSON to FILENAME (default is stdout)\n"
+            << "  -l,  --length-limit=BITS         limit the length of codewords (default is 32)\n"
+            << "  -b,  --block-size=BYTES          code the input in blocks of BYTES (default is 1048576)\n"
+            << "  -B,  --length-buckets            code run lengths as length codes with extra bits\n"
+            << "  -I,  --interleave                deal the codewords of each block to 4 bitstreams\n"
+            << "  -s,  --sample=N                  measure each corpus again, with the code of each block built from\n"
+            << "                                   1 in N of its chunks, and print the ratio lost and the time saved\n"
+            << "  -C,  --contexts                  measure each corpus again, with a table for the runs after each symbol,\n"
+            << "                                   and print the ratio saved and the decompression time added\n"
+            << "  -T,  --threads=N                 code N blocks at once; 0 is one for each core (default is 1)\n"
+            << "  -A,  --adaptive                  measure each corpus again, with one-pass adaptive codes,\n"
+            << "                                   and print their ratio and times against the two-pass ones\n"
+            << "  -x,  --scaling=N                 measure each corpus again with 1, 2, 4 and so on up to N threads,\n"
+            << "                                   and print the speedup of each against 1 thread\n"
+            << "  -n,  --messages=N                number of messages (default is 100000)\n"
+            << "  -m,  --message-size=BYTES        bytes of each message (default is 256)\n"
+            << "  -k,  --codebook                  code the messages with a codebook, trained on 1000 other messages\n";
+    }
+};
+
+/** Generator of the corpora; the same seed gives the same bytes on every platform */
+class Random
+{
+private:
+    uint32_t state_;
+
+public:
+    Random(const uint32_t & seed)
+    : state_    (seed)
+    {}
+
+    /** 16 random bits */
+    uint32_t
+    Next(void)
+    {
+        state_ = state_ * 1103515245 + 12345;
+        return (state_ >> 16) & 0xffff;
+    }
+
+    /** Random number below n, for small n */
+    uint32_t
+    Below(const uint32_t & n)
+    { return uint32_t((uint64_t(Next()) << 16 | Next()) % n); }
+};
+
+/** Text-like message; words from a small vocabulary, with a few repeated bytes */
+static void
+MakeMessage(std::vector<uint8_t> & message, const size_t & size, unsigned int & seed)
+{
+    static const char * words[] = { "the ", "sensor ", "value ", "of ", "0000", "id=", "42 ", "temp ", "ok\n", "   " };
+
+    message.clear();
+    while(message.size() < size)
+    {
+        seed = seed * 1103515245 + 12345;
+        const char * word = words[(seed >> 16) % (sizeof(words) / sizeof(words[0]))];
+
+        for(; *word != '\0' && message.size() < size; ++word)
+            message.push_back(uint8_t(*word));
+    }
+}
+
+/** Uniformly random bytes; nothing to gain */
+static void
+MakeRandom(std::vector<uint8_t> & data, const size_t & size)
+{
+    Random random(1);
+
+    data.resize(size);
+    for(auto & byte : data)
+        byte = uint8_t(random.Next());
+}
+
+/** Bytes of a Zipf distribution; byte k is drawn with a weight of 1 / (k + 1) */
+static void
+MakeZipf(std::vector<uint8_t> & data, const size_t & size)
+{
+    Random random(2);
+
+    std::vector<double> cdf(256);
+    double sum = 0;
+
+    for(size_t k = 0; k < cdf.size(); ++k)
+        cdf[k] = (sum += 1.0 / double(k + 1));
+
+    data.resize(size);
+    for(auto & byte : data)
+    {
+        double u = double(random.Below(1 << 30)) / double(1 << 30) * sum;
+        byte = uint8_t(std::min(size_t(255), size_t(std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin())));
+    }
+}
+
+/** Readings of a slow sensor; each is held for a run of 1 to 64 samples, and drifts by a little */
+static void
+MakeSensor(std::vector<uint8_t> & data, const size_t & size)
+{
+    Random random(3);
+    int value = 128;
+
+    data.clear();
+    while(data.size() < size)
+    {
+        size_t run_len = std::min(size_t(1 + random.Below(64)), size - data.size());
+        data.insert(data.end(), run_len, uint8_t(value));
+
+        value = std::max(0, std::min(255, value + int(random.Below(5)) - 2));
+    }
+}
+
+/** English-like text; words of a vocabulary, the first ones more often, in sentences and lines */
+static void
+MakeText(std::vector<uint8_t> & data, const size_t & size)
+{
+    static const char * words[] =
+    {
+        "the", "of", "and", "to", "a", "in", "is", "it", "that", "was", "for", "on", "are", "with", "as",
+        "be", "at", "one", "have", "this", "from", "by", "not", "but", "what", "all", "were", "when", "we",
+        "there", "can", "an", "which", "their", "said", "if", "do", "will", "each", "about", "how", "up",
+        "out", "them", "then", "she", "many", "some", "so", "these", "would", "other", "into", "has", "more",
+        "compression", "huffman", "block", "stream", "symbol", "length", "table", "decoder", "encoder"
+    };
+    const size_t word_count = sizeof(words) / sizeof(words[0]);
+
+    Random random(4);
+    size_t line_len = 0;
+    bool sentence_start = true;
+
+    data.clear();
+    while(data.size() < size)
+    {
+        /** The product of two draws favours the first words */
+        std::string word = words[random.Below(word_count) * random.Below(word_count) / word_count];
+
+        if(sentence_start)
+            word[0] = char(std::toupper(word[0]));
+
+        sentence_start = random.Below(12) == 0;
+        if(sentence_start)
+            word += '.';
+        else if(random.Below(16) == 0)
+            word += ',';
+
+        line_len += word.size() + 1;
+        word += line_len > 72 ? '\n' : ' ';
+        if(line_len > 72)
+            line_len = 0;
+
+        data.insert(data.end(), word.begin(), word.end());
+    }
+
+    data.resize(size);
+}
+
+/** Structured binary records, as replicated between nodes; a counter, a timestamp, a kind, a name,
+    a reading and a status, each byte telling much about the next one
+*/
+static void
+MakeRecords(std::vector<uint8_t> & data, const size_t & size)
+{
+    static const char * names[] = { "alpha", "beta", "gamma", "delta", "omega" };
+    static const uint8_t kinds[] = { 1, 2, 2, 3, 7 };
+    static const uint16_t statuses[] = { 0, 100, 200, 0xffff };
+
+    Random random(5);
+    uint32_t time = 1700000000;
+
+    auto put = [&](const uint32_t & value, const size_t & bytes)
+    {
+        for(size_t i = 0; i < bytes; ++i)
+            data.push_back(uint8_t(value >> (8 * i)));
+    };
+
+    data.clear();
+    for(uint32_t id = 0; data.size() < size; ++id)
+    {
+        time += random.Below(4);
+
+        put(id, 4);
+        put(time, 4);
+        put(kinds[random.Below(5)], 1);
+
+        std::string name = names[random.Below(5)];
+        name.resize(8, ' ');
+        data.insert(data.end(), name.begin(), name.end());
+
+        put(uint32_t(int32_t(random.Below(601)) - 300), 2);
+        put(statuses[random.Below(4)], 2);
+        put('\n', 1);
+    }
+
+    data.resize(size);
+}
+
+/** Peak resident memory of the process in KiB, since it started or since ResetPeakRss */
+static size_t
+PeakRss(void)
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+
+    while(std::getline(status, line))
+        if(line.compare(0, 6, "VmHWM:") == 0)
+            return size_t(std::strtoul(line.c_str() + 6, nullptr, 10));
+
+    /** Without procfs; the peak since the start */
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    return size_t(usage.ru_maxrss);
+}
+
+/** Start the peak of PeakRss over from the memory in use now, where the kernel lets us */
+static void
+ResetPeakRss(void)
+{
+    std::ofstream clear_refs("/proc/self/clear_refs");
+    clear_refs << "5";
+}
+
+/** The name as a JSON string */
+static std::string
+JsonString(const std::string & name)
+{
+    std::string out = "\"";
+
+    for(char ch : name)
+    {
+        if(ch == '"' || ch == '\\')
+            out += std::string("\\") + ch;
+        else if((unsigned char)ch < 0x20)
+        {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned int)(unsigned char)ch);
+            out += escaped;
+        }
+        else
+            out += ch;
+    }
+
+    return out + "\"";
+}
+
+/** Measurements of one corpus; times are of the fastest of the repeats */
+struct Result
+{
+    std::string         name;
+    size_t              size;
+    size_t              compressed_size;
+    double              compress_time;
+    double              decompress_time;
+    Huffman::StatsType  compress_stats;     /**< Phases of the fastest compression */
+    Huffman::StatsType  decompress_stats;   /**< Phases of the fastest decompression */
+    size_t              peak_rss;           /**< KiB of the whole process, at its peak while measuring */
+    bool                verified;
+    size_t              sample_stride;
+    double              ratio_loss;         /**< Growth of the output against every chunk counted; 0.01 is 1% larger */
+    double              time_saved;         /**< Compression time saved against every chunk counted; 0.25 is 25% less */
+    bool                contexts;
+    double              ratio_saved;        /**< Output saved by the tables of the contexts, against one table; 0.25 is 25% smaller */
+    double              decode_time_added;  /**< Decompression time added by them; 0.25 is 25% more */
+    size_t              threads;
+    bool                scaling;
+    double              compress_speedup;   /**< Compression time of 1 thread over this one; 2 is twice as fast */
+    double              decompress_speedup; /**< Decompression time of 1 thread over this one */
+    bool                adaptive;
+    double              ratio_added;        /**< Growth of the output of the adaptive codes, against the two-pass ones; 0.01 is 1% larger */
+    double              compress_time_ratio;    /**< Compression time of the adaptive codes over the two-pass ones; 2 is twice as slow */
+    double              decompress_time_ratio;  /**< Decompression time of them over the two-pass ones */
+};
+
+static Result
+Measure(Huffman & huffman, const std::string & name, const std::vector<uint8_t> & data, const size_t & repeat)
+{
+    typedef std::chrono::steady_clock ClockType;
+
+    Result result;
+    result.name             = name;
+    result.size             = data.size();
+    result.compressed_size  = 0;
+    result.compress_time    = 0;
+    result.decompress_time  = 0;
+    result.sample_stride    = huffman.GetSampleStride();
+    result.ratio_loss       = 0;
+    result.time_saved       = 0;
+    result.contexts         = huffman.GetContexts();
+    result.ratio_saved      = 0;
+    result.decode_time_added = 0;
+    result.threads          = huffman.GetThreadCount();
+    result.scaling          = false;
+    result.compress_speedup = 0;
+    result.decompress_speedup = 0;
+    result.adaptive         = huffman.GetAdaptive();
+    result.ratio_added      = 0;
+    result.compress_time_ratio = 0;
+    result.decompress_time_ratio = 0;
+
+    ResetPeakRss();
+
+    std::vector<uint8_t> packed(huffman.CompressBound(data.size()));
+    std::vector<uint8_t> restored(data.size());
+
+    for(size_t i = 0; i < repeat; ++i)
+    {
+        Huffman::StatsType stats;
+        huffman.SetStats(&stats);
+
+        ClockType::time_point start = ClockType::now();
+        result.compressed_size = huffman.Compress(data.data(), data.size(), packed.data(), packed.size());
+        double time = std::chrono::duration<double>(ClockType::now() - start).count();
+
+        if(i == 0 || time < result.compress_time)
+        {
+            result.compress_time    = time;
+            result.compress_stats   = stats;
+        }
+    }
+
+    for(size_t i = 0; i < repeat; ++i)
+    {
+        Huffman::StatsType stats;
+        huffman.SetStats(&stats);
+
+        ClockType::time_point start = ClockType::now();
+        huffman.Decompress(packed.data(), result.compressed_size, restored.data(), restored.size());
+        double time = std::chrono::duration<double>(ClockType::now() - start).count();
+
+        if(i == 0 || time < result.decompress_time)
+        {
+            result.decompress_time  = time;
+            result.decompress_stats = stats;
+        }
+    }
+
+    huffman.SetStats(nullptr);
+
+    result.peak_rss = PeakRss();
+    result.verified = result.compressed_size > 0 && restored == data;
+
+    return result;
+}
+
+static void
+WriteJson(std::ostream & out, const Huffman & huffman, const size_t & repeat, const std::vector<Result> & results)
+{
+    char line[512];
+
+    out << "{\n"
+        << "  \"settings\": {\n";
+
+    std::snprintf(line, sizeof(line),
+                  "    \"block_size\": %zu,\n    \"threads\": %zu,\n    \"length_limit\": %zu,\n"
+                  "    \"length_buckets\": %s,\n    \"interleave\": %s,\n    \"repeat\": %zu\n",
+                  huffman.GetBlockSize(), huffman.GetThreadCount(), huffman.GetCodewordLengthLimit(),
+                  huffman.GetLengthBuckets() ? "true" : "false", huffman.GetInterleaved() ? "true" : "false", repeat);
+    out << line
+        << "  },\n"
+        << "  \"results\": [\n";
+
+    for(size_t i = 0; i < results.size(); ++i)
+    {
+        const Result & result = results[i];
+        const double mb = double(result.size) / 1e6;
+
+        out << "    {\n"
+            << "      \"corpus\": " << JsonString(result.name) << ",\n";
+
+        std::snprintf(line, sizeof(line),
+                      "      \"size\": %zu,\n      \"compressed_size\": %zu,\n      \"ratio\": %.4f,\n"
+                      "      \"compress_mb_per_s\": %.2f,\n      \"decompress_mb_per_s\": %.2f,\n"
+                      "      \"length_limit_cost\": %.6f,\n"
+                      "      \"peak_rss_kib\": %zu,\n      \"verified\": %s,\n",
+                      result.size, result.compressed_size,
+                      result.size > 0 ? double(result.compressed_size) / double(result.size) : 0.0,
+                      result.compress_time > 0 ? mb / result.compress_time : 0.0,
+                      result.decompress_time > 0 ? mb / result.decompress_time : 0.0,
+                      result.compress_stats.LengthLimitCost(),
+                      result.peak_rss, result.verified ? "true" : "false");
+        out << line;
+
+        std::snprintf(line, sizeof(line),
+                      "      \"seconds\": {\n"
+                      "        \"compress\": %.6f,\n        \"decompress\": %.6f,\n"
+                      "        \"collect_runs\": %.6f,\n        \"create_huffman_tree\": %.6f,\n"
+                      "        \"encode\": %.6f,\n        \"decode\": %.6f\n"
+                      "      }",
+                      result.compress_time, result.decompress_time,
+                      result.compress_stats.collect_runs_time, result.compress_stats.create_tree_time,
+                      result.compress_stats.encode_time, result.decompress_stats.decode_time);
+        out << line;
+
+        std::snprintf(line, sizeof(line), ",\n      \"sample_stride\": %zu", result.sample_stride);
+        out << line;
+
+        if(result.sample_stride > 1)
+        {
+            std::snprintf(line, sizeof(line), ",\n      \"ratio_loss\": %.4f,\n      \"compress_time_saved\": %.4f",
+                          result.ratio_loss, result.time_saved);
+            out << line;
+        }
+
+        std::snprintf(line, sizeof(line), ",\n      \"threads\": %zu", result.threads);
+        out << line;
+
+        if(result.scaling)
+        {
+            std::snprintf(line, sizeof(line), ",\n      \"compress_speedup\": %.4f,\n      \"decompress_speedup\": %.4f",
+                          result.compress_speedup, result.decompress_speedup);
+            out << line;
+        }
+
+        std::snprintf(line, sizeof(line), ",\n      \"contexts\": %s", result.contexts ? "true" : "false");
+        out << line;
+
+        if(result.contexts)
+        {
+            std::snprintf(line, sizeof(line), ",\n      \"ratio_saved\": %.4f,\n      \"decompress_time_added\": %.4f",
+                          result.ratio_saved, result.decode_time_added);
+            out << line;
+        }
+
+        std::snprintf(line, sizeof(line), ",\n      \"adaptive\": %s", result.adaptive ? "true" : "false");
+        out << line;
+
+        if(result.adaptive)
+        {
+            std::snprintf(line, sizeof(line), ",\n      \"ratio_added\": %.4f,\n      \"compress_time_ratio\": %.4f,\n      \"decompress_time_ratio\": %.4f",
+                          result.ratio_added, result.compress_time_ratio, result.decompress_time_ratio);
+            out << line;
+        }
+
+        out << "\n"
+            << "    }" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+
+    out << "  ]\n"
+        << "}\n";
+}
+
+static int
+RunMessages(const std::string & this_file, const size_t & message_count, const size_t & message_size, const bool & use_codebook)
+{
+    typedef std::chrono::steady_clock ClockType;
+
+    std::vector<uint8_t> message;
+    std::vector<uint8_t> restored;
+    unsigned int seed = 1;
+
+    Huffman huffman;
+    CountStreamBuffer sink;
+    std::ostream fout(&sink);
+
+    Codebook codebook;
+    if(use_codebook)
+    {
+        /** Trained on messages of another seed than the measured ones */
+        std::vector<std::vector<uint8_t> > sample_data(1000);
+        std::vector<std::pair<const Huffman::ByteType *, Huffman::SizeType> > samples;
+        unsigned int sample_seed = 2;
+
+        for(auto & data : sample_data)
+        {
+            MakeMessage(data, message_size, sample_seed);
+            samples.push_back(std::make_pair(data.data(), data.size()));
+        }
+
+        huffman.Train(samples, codebook);
+    }
+
+    auto compress = [&](std::ostream & out)
+    {
+        if(use_codebook)
+            huffman.Compress(message.data(), message.size(), out, codebook);
+        else
+            huffman.Compress(message.data(), message.size(), out);
+    };
+
+    /** A few messages of another seed first, so that the coder has grown its buffers to the largest of them */
+    unsigned int warm_seed = 3;
+    for(size_t i = 0; i < 64; ++i)
+    {
+        MakeMessage(message, message_size, warm_seed);
+        compress(fout);
+    }
+
+    size_t compress_allocs = 0;
+    size_t compress_bytes = 0;
+    double compress_time = 0;
+
+    for(size_t i = 0; i < message_count; ++i)
+    {
+        MakeMessage(message, message_size, seed);
+
+        size_t allocs = alloc_count;
+        size_t bytes = alloc_bytes;
+        ClockType::time_point start = ClockType::now();
+
+        huffman.Reset();
+        compress(fout);
+
+        compress_time += std::chrono::duration<double>(ClockType::now() - start).count();
+        compress_allocs += alloc_count - allocs;
+        compress_bytes += alloc_bytes - bytes;
+    }
+
+    /** Decompress one message, from memory into memory */
+    std::ostringstream packed_out;
+    compress(packed_out);
+    const std::string packed = packed_out.str();
+    restored.resize(message.size());
+
+    /** One message first, so that the decoder has grown its buffers */
+    if(use_codebook)
+        huffman.Decompress((const uint8_t *)packed.data(), packed.size(), restored.data(), restored.size(), codebook);
+    else
+        huffman.Decompress((const uint8_t *)packed.data(), packed.size(), restored.data(), restored.size());
+
+    size_t decompress_allocs = 0;
+    size_t decompress_bytes = 0;
+    double decompress_time = 0;
+
+    for(size_t i = 0; i < message_count; ++i)
+    {
+        size_t allocs = alloc_count;
+        size_t bytes = alloc_bytes;
+        ClockType::time_point start = ClockType::now();
+
+        huffman.Reset();
+        if(use_codebook)
+            huffman.Decompress((const uint8_t *)packed.data(), packed.size(), restored.data(), restored.size(), codebook);
+        else
+            huffman.Decompress((const uint8_t *)packed.data(), packed.size(), restored.data(), restored.size());
+
+        decompress_time += std::chrono::duration<double>(ClockType::now() - start).count();
+        decompress_allocs += alloc_count - allocs;
+        decompress_bytes += alloc_bytes - bytes;
+    }
+
+    if(restored != message)
+    {
+        std::cerr << this_file << ": decompressed message differs\n";
+        return 1;
+    }
+
+    double n = double(message_count);
+
+    std::printf("messages            %zu x %zu bytes, %zu bytes compressed\n", message_count, message_size, packed.size());
+    std::printf("compress            %8.2f allocations %10.0f bytes %8.2f us per message\n",
+                compress_allocs / n, compress_bytes / n, compress_time / n * 1e6);
+    std::printf("decompress          %8.2f allocations %10.0f bytes %8.2f us per message\n",
+                decompress_allocs / n, decompress_bytes / n, decompress_time / n * 1e6);
+
+    return 0;
+}
+
+int
+main(const int argc, char * const argv[])
+{
+    size_t message_count = 100000;
+    size_t message_size = 256;
+    bool use_codebook = false;
+    bool messages = false;
+
+    std::vector<std::string> corpora;
+    size_t corpus_size = 8 << 20;
+    size_t repeat = 5;
+    std::vector<size_t> sample_strides = { 1 };
+    bool contexts = false;
+    bool adaptive = false;
+    size_t scaling = 0;
+    std::string output_file;
+
+    Huffman huffman;
+
+    {
+        /** getopt(3) */
+
+        int c;
+
+        while(true)
+        {
+            int option_index = 0;
+            static struct option options[] =
+            {
+                { "help",           no_argument,        nullptr, 'h' },
+                { "corpus",         required_argument,  nullptr, 'c' },
+                { "size",           required_argument,  nullptr, 'S' },
+                { "repeat",         required_argument,  nullptr, 'r' },
+                { "output-file",    required_argument,  nullptr, 'o' },
+                { "length-limit",   required_argument,  nullptr, 'l' },
+                { "block-size",     required_argument,  nullptr, 'b' },
+                { "length-buckets", no_argument,        nullptr, 'B' },
+                { "interleave",     no_argument,        nullptr, 'I' },
+                { "sample",         required_argument,  nullptr, 's' },
+                { "contexts",       no_argument,        nullptr, 'C' },
+                { "adaptive",       no_argument,        nullptr, 'A' },
+                { "threads",        required_argument,  nullptr, 'T' },
+                { "scaling",        required_argument,  nullptr, 'x' },
+                { "messages",       required_argument,  nullptr, 'n' },
+                { "message-size",   required_argument,  nullptr, 'm' },
+                { "codebook",       no_argument,        nullptr, 'k' },
+                { nullptr,          0,                  nullptr, 0   }
+            };
+
+            c = getopt_long(argc, argv, "hc:S:r:o:l:b:BIs:CAT:x:n:m:k", options, &option_index);
+
+            if(c == -1)
+                break;
+
+            switch(c)
+            {
+            case 'c': /** --corpus */
+                if(std::string(optarg) != "random" && std::string(optarg) != "zipf"
+                && std::string(optarg) != "sensor" && std::string(optarg) != "text"
+                && std::string(optarg) != "records")
+                {
+                    std::cerr << argv[0] << ": unknown corpus `" << optarg << "'\n";
+                    return 1;
+                }
+
+                corpora.push_back(optarg);
+                break;
+
+            case 'S': /** --size */
+                corpus_size = strtoul(optarg, nullptr, 10);
+                break;
+
+            case 'r': /** --repeat */
+                repeat = std::max(size_t(1), size_t(strtoul(optarg, nullptr, 10)));
+                break;
+
+            case 'o': /** --output-file */
+                output_file = optarg;
+                break;
+
+            case 'l': /** --length-limit */
+                huffman.SetCodewordLengthLimit(strtoul(optarg, nullptr, 10));
+                break;
+
+            case 'b': /** --block-size */
+                huffman.SetBlockSize(strtoul(optarg, nullptr, 10));
+                break;
+
+            case 'B': /** --length-buckets */
+                huffman.SetLengthBuckets(true);
+                break;
+
+            case 'I': /** --interleave */
+                huffman.SetInterleaved(true);
+                break;
+
+            case 's': /** --sample */
+                sample_strides.push_back(std::max(size_t(2), size_t(strtoul(optarg, nullptr, 10))));
+                break;
+
+            case 'C': /** --contexts */
+                contexts = true;
+                break;
+
+            case 'A': /** --adaptive */
+                adaptive = true;
+                break;
+
+            case 'T': /** --threads */
+                huffman.SetThreadCount(strtoul(optarg, nullptr, 10));
+                break;
+
+            case 'x': /** --scaling */
+                scaling = strtoul(optarg, nullptr, 10);
+                break;
+
+            case 'n': /** --messages */
+                message_count = strtoul(optarg, nullptr, 10);
+                messages = true;
+                break;
+
+            case 'm': /** --message-size */
+                message_size = strtoul(optarg, nullptr, 10);
+                messages = true;
+                break;
+
+            case 'k': /** --codebook */
+                use_codebook = true;
+                messages = true;
+                break;
+
+            case 'h': /** --help */
+                Msg::Usage(std::cout, argv[0]);
+                return 0;
+
+            default:
+                Msg::Usage(std::cout, argv[0]);
+                return 1;
+            }
+        }
+    }
+
+    if(messages)
+        return RunMessages(argv[0], message_count, message_size, use_codebook);
+
+    if(corpora.empty() && optind == argc)
+        corpora = { "random", "zipf", "sensor", "text", "records" };
+
+    std::vector<Result> results;
+    std::vector<uint8_t> data;
+
+    /** Each sample stride after the first is compared with it, every chunk counted, and so are the contexts and the adaptive codes */
+    auto measure = [&](const std::string & name)
+    {
+        const size_t first = results.size();
+
+        for(size_t i = 0; i < sample_strides.size(); ++i)
+        {
+            huffman.SetSampleStride(sample_strides[i]);
+            results.push_back(Measure(huffman, name, data, repeat));
+
+            const Result & all = results[first];
+            Result & sampled = results.back();
+
+            if(i > 0 && all.compressed_size > 0 && all.compress_time > 0)
+            {
+                sampled.ratio_loss = double(sampled.compressed_size) / double(all.compressed_size) - 1;
+                sampled.time_saved = 1 - sampled.compress_time / all.compress_time;
+            }
+        }
+
+        if(contexts)
+        {
+            huffman.SetSampleStride(1);
+            huffman.SetContexts(true);
+            results.push_back(Measure(huffman, name, data, repeat));
+            huffman.SetContexts(false);
+
+            const Result & single = results[first];
+            Result & context = results.back();
+
+            if(single.compressed_size > 0 && single.decompress_time > 0)
+            {
+                context.ratio_saved = 1 - double(context.compressed_size) / double(single.compressed_size);
+                context.decode_time_added = context.decompress_time / single.decompress_time - 1;
+            }
+        }
+
+        if(adaptive)
+        {
+            huffman.SetSampleStride(1);
+            huffman.SetAdaptive(true);
+            results.push_back(Measure(huffman, name, data, repeat));
+            huffman.SetAdaptive(false);
+
+            const Result & two_pass = results[first];
+            Result & one_pass = results.back();
+
+            if(two_pass.compressed_size > 0 && two_pass.compress_time > 0 && two_pass.decompress_time > 0)
+            {
+                one_pass.ratio_added = double(one_pass.compressed_size) / double(two_pass.compressed_size) - 1;
+                one_pass.compress_time_ratio = one_pass.compress_time / two_pass.compress_time;
+                one_pass.decompress_time_ratio = one_pass.decompress_time / two_pass.decompress_time;
+            }
+        }
+
+        if(scaling > 0)
+        {
+            const size_t threads = huffman.GetThreadCount();
+            const size_t base = results.size();
+
+            huffman.SetSampleStride(1);
+
+            for(size_t n = 1; n <= scaling; n = n < scaling && n * 2 > scaling ? scaling : n * 2)
+            {
+                huffman.SetThreadCount(n);
+                results.push_back(Measure(huffman, name, data, repeat));
+
+                const Result & one = results[base];
+                Result & scaled = results.back();
+
+                scaled.scaling = true;
+                if(scaled.compress_time > 0 && scaled.decompress_time > 0)
+                {
+                    scaled.compress_speedup = one.compress_time / scaled.compress_time;
+                    scaled.decompress_speedup = one.decompress_time / scaled.decompress_time;
+                }
+            }
+
+            huffman.SetThreadCount(threads);
+        }
+    };
+
+    for(const auto & corpus : corpora)
+    {
+        if(corpus == "random")
+            MakeRandom(data, corpus_size);
+        else if(corpus == "zipf")
+            MakeZipf(data, corpus_size);
+        else if(corpus == "sensor")
+            MakeSensor(data, corpus_size);
+        else if(corpus == "text")
+            MakeText(data, corpus_size);
+        else
+            MakeRecords(data, corpus_size);
+
+        measure(corpus);
+    }
+
+    for(int i = optind; i < argc; ++i)
+    {
+        std::ifstream fin(argv[i], std::ios::binary);
+        if(! fin.is_open())
+        {
+            std::cerr << argv[0] << ": " << argv[i] << ": cannot open\n";
+            return 1;
+        }
+
+        data.assign(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+        measure(argv[i]);
+    }
+
+    std::ofstream fout;
+    if(! output_file.empty())
+    {
+        fout.open(output_file);
+        if(! fout.is_open())
+        {
+            std::cerr << argv[0] << ": " << output_file << ": cannot open\n";
+            return 1;
+        }
+    }
+
+    WriteJson(output_file.empty() ? std::cout : fout, huffman, repeat, results);
+
+    for(const auto & result : results)
+    {
+        if(! result.verified)
+        {
+            std::cerr << argv[0] << ": " << result.name << ": decompressed corpus differs\n";
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,798 @@
+#include "huffman.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <streambuf>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+
+using namespace algorithm;
+
+typedef std::vector<uint8_t> BytesType;
+
+/** Checks failed so far; each is printed as it fails */
+static size_t failures = 0;
+
+static void
+Check(const bool & ok, const std::string & what)
+{
+    if(ok)
+        return;
+
+    std::cerr << "FAIL: " << what << std::endl;
+    ++failures;
+}
+
+/** Generator of the inputs; the same seed gives the same bytes on every platform */
+class Random
+{
+private:
+    uint32_t state_;
+
+public:
+    Random(const uint32_t & seed)
+    : state_    (seed)
+    {}
+
+    /** 16 random bits */
+    uint32_t
+    Next(void)
+    {
+        state_ = state_ * 1103515245 + 12345;
+        return (state_ >> 16) & 0xffff;
+    }
+
+    /** Random number below n, for small n */
+    uint32_t
+    Below(const uint32_t & n)
+    { return uint32_t((uint64_t(Next()) << 16 | Next()) % n); }
+};
+
+/** Words from a small vocabulary, with runs of spaces and zeros */
+static BytesType
+MakeText(const size_t & size, const uint32_t & seed)
+{
+    static const char * words[] = { "the ", "huffman ", "code ", "of ", "0000", "run ", "   ", "length ", "ok\n", "zzzzzzzz " };
+
+    Random random(seed);
+    BytesType data;
+
+    while(data.size() < size)
+    {
+        const char * word = words[random.Below(sizeof(words) / sizeof(words[0]))];
+        data.insert(data.end(), word, word + std::strlen(word));
+    }
+
+    data.resize(size);
+    return data;
+}
+
+/** Records of 16 bytes, where each field says much about the next byte */
+static BytesType
+MakeRecords(const size_t & size, const uint32_t & seed)
+{
+    static const char * kinds[] = { "TEMP", "HUMI", "PRES", "WIND" };
+
+    Random random(seed);
+    BytesType data;
+
+    while(data.size() < size)
+    {
+        const char * kind = kinds[random.Below(4)];
+
+        data.push_back('#');
+        data.insert(data.end(), kind, kind + 4);
+        data.push_back(':');
+        for(int i = 0; i < 4; ++i)
+            data.push_back(uint8_t('0' + random.Below(3)));
+        data.insert(data.end(), 5, uint8_t(' '));
+        data.push_back('\n');
+    }
+
+    data.resize(size);
+    return data;
+}
+
+static BytesType
+MakeRandom(const size_t & size, const uint32_t & seed)
+{
+    Random random(seed);
+    BytesType data(size);
+
+    for(auto & byte : data)
+        byte = uint8_t(random.Next());
+
+    return data;
+}
+
+static BytesType
+ReadFile(const std::string & path)
+{
+    std::ifstream fin(path, std::ios::binary);
+    Check(fin.good(), "open " + path);
+
+    return BytesType((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+}
+
+static std::string
+ToString(const BytesType & data)
+{ return std::string(data.begin(), data.end()); }
+
+static BytesType
+ToBytes(const std::string & data)
+{ return BytesType(data.begin(), data.end()); }
+
+/** Input that cannot be seeked, as a pipe; bytes come in chunks of a few bytes */
+class PipeBuffer : public std::streambuf
+{
+private:
+    std::string data_;
+    size_t      pos_;
+
+public:
+    PipeBuffer(const BytesType & data)
+    : data_ (ToString(data))
+    , pos_  (0)
+    {}
+
+protected:
+    int_type
+    underflow(void)
+    {
+        if(pos_ >= data_.size())
+            return traits_type::eof();
+
+        char * begin = &data_[pos_];
+        const size_t len = std::min(data_.size() - pos_, size_t(7));
+
+        pos_ += len;
+        setg(begin, begin, begin + len);
+
+        return traits_type::to_int_type(*begin);
+    }
+};
+
+/** Output that throws once `left' bytes are written */
+class FailingOutput : public std::streambuf
+{
+private:
+    size_t left_;
+
+public:
+    FailingOutput(const size_t & left)
+    : left_ (left)
+    {}
+
+protected:
+    std::streamsize
+    xsputn(const char *, std::streamsize len)
+    {
+        if(size_t(len) > left_)
+            throw std::runtime_error("output failed");
+
+        left_ -= size_t(len);
+        return len;
+    }
+
+    int_type
+    overflow(int_type ch)
+    {
+        if(left_ == 0)
+            throw std::runtime_error("output failed");
+
+        --left_;
+        return ch;
+    }
+};
+
+/** Input that throws once `left' bytes are read */
+class FailingInput : public std::streambuf
+{
+private:
+    std::vector<char>   chunk_;
+    size_t              left_;
+
+public:
+    FailingInput(const size_t & left)
+    : chunk_    (1 << 16, 'a')
+    , left_     (left)
+    {}
+
+protected:
+    int_type
+    underflow(void)
+    {
+        if(left_ < chunk_.size())
+            throw std::runtime_error("input failed");
+
+        left_ -= chunk_.size();
+        setg(&chunk_[0], &chunk_[0], &chunk_[0] + chunk_.size());
+
+        return traits_type::to_int_type(chunk_[0]);
+    }
+};
+
+static BytesType
+Compress(Huffman & huffman, const BytesType & data)
+{
+    std::istringstream fin(ToString(data));
+    std::ostringstream fout;
+
+    Check(huffman.Compress(fin, fout), "compress");
+    return ToBytes(fout.str());
+}
+
+static bool
+Decompress(Huffman & huffman, const BytesType & data, BytesType & out)
+{
+    std::istringstream fin(ToString(data));
+    std::ostringstream fout;
+
+    bool ok = huffman.Decompress(fin, fout);
+
+    out = ToBytes(fout.str());
+    return ok;
+}
+
+/** Format version of a compressed stream, from its header */
+static int
+Version(const BytesType & data)
+{ return data.size() >= 4 && std::memcmp(&data[0], "HUF", 3) == 0 ? int(data[3]) : -1; }
+
+/** Flags of the first block of a stream of format 3: its raw size as a varint follows the header */
+static int
+FirstBlockFlags(const BytesType & data)
+{
+    size_t pos = 4;
+
+    while(pos < data.size() && (data[pos] & 0x80) != 0)
+        ++pos;
+
+    return pos + 1 < data.size() ? int(data[pos + 1]) : -1;
+}
+
+/** Through a stream and from memory, at each of the thread counts; the output does not depend on them.
+    The first block has to be flagged with `flags', unless it is -1.
+*/
+static void
+RoundTrip(Huffman & huffman, const BytesType & data, const std::string & name, const int & flags)
+{
+    BytesType first;
+
+    for(Huffman::SizeType threads : { 1, 3 })
+    {
+        huffman.SetThreadCount(threads);
+
+        const std::string what = name + " with " + std::to_string(threads) + " thread(s)";
+
+        BytesType compressed = Compress(huffman, data);
+        BytesType decompressed;
+        Huffman decoder;
+        decoder.SetThreadCount(threads);
+
+        if(first.empty())
+            first = compressed;
+
+        Check(compressed == first, what + ": output depends on the thread count");
+        Check(Version(compressed) == Huffman::format_version, what + ": format version");
+        Check(flags < 0 || FirstBlockFlags(compressed) == flags, what + ": block flags");
+        Check(Decompress(decoder, compressed, decompressed) && decompressed == data, what + ": stream round trip");
+
+        /** From memory, coded in place, into a buffer of the bound; and one byte too small */
+        std::ostringstream fout;
+        Check(huffman.Compress(data.data(), data.size(), fout) && ToBytes(fout.str()) == first, what + ": memory compression");
+
+        BytesType bounded(huffman.CompressBound(data.size()));
+        Huffman::SizeType len = huffman.Compress(data.data(), data.size(), bounded.data(), bounded.size());
+
+        Check(len > 0 && BytesType(bounded.begin(), bounded.begin() + len) == first, what + ": compression into memory");
+        Check(huffman.Compress(data.data(), data.size(), bounded.data(), len - 1) == 0, what + ": too small a buffer taken");
+
+        Huffman::SizeType size = 0;
+        Check(decoder.GetDecompressedSize(first.data(), first.size(), size) && size == data.size(), what + ": decompressed size");
+
+        BytesType out(data.size());
+        Check(decoder.Decompress(first.data(), first.size(), out.data(), out.size()) && out == data, what + ": memory round trip");
+    }
+}
+
+/** Streams written by the earlier versions of the library, and round trips of each kind of input */
+static void
+Formats(const std::string & res)
+{
+    const BytesType sample = ReadFile(res + "/sample.txt");
+
+    for(int version : { 0, 1, 2, 3, 5 })
+    {
+        const std::string name = "sample.v" + std::to_string(version) + ".huf";
+        const BytesType compressed = ReadFile(res + "/" + name);
+
+        Huffman huffman;
+        BytesType decompressed;
+
+        Check(Decompress(huffman, compressed, decompressed) && decompressed == sample, name + ": decompression");
+
+        /** The same coder takes the next stream as well */
+        huffman.Reset();
+        Check(Decompress(huffman, compressed, decompressed) && decompressed == sample, name + ": decompression after Reset");
+    }
+
+    Huffman huffman;
+    RoundTrip(huffman, sample, "sample", -1);
+    RoundTrip(huffman, MakeText(200000, 1), "text", -1);
+    RoundTrip(huffman, MakeRecords(200000, 2), "records", -1);
+    RoundTrip(huffman, MakeRandom(200000, 3), "random", -1);
+    RoundTrip(huffman, BytesType(70000, 'x'), "one run", -1);
+    RoundTrip(huffman, BytesType(), "empty", -1);
+
+    Huffman blocked;
+    blocked.SetBlockSize(1 << 16);
+    RoundTrip(blocked, MakeText(200000, 1), "text in blocks of 64 KiB", -1);
+    RoundTrip(blocked, BytesType(70000, 'x'), "one run over two blocks", -1);
+
+    Huffman limited;
+    limited.SetCodewordLengthLimit(9);
+    RoundTrip(limited, MakeText(200000, 1), "text limited to 9 bits", -1);
+    RoundTrip(limited, MakeRandom(200000, 3), "random limited to 9 bits", -1);
+
+    /** The cost of the limit is of the tables written by the last compression; the stats count the same ones */
+    for(bool contexts : { false, true })
+    {
+        Huffman::StatsType stats;
+        limited.SetContexts(contexts);
+        limited.SetStats(&stats);
+        Compress(limited, MakeText(200000, 1));
+        limited.SetStats(nullptr);
+
+        Check(limited.GetLengthLimitCost() == stats.LengthLimitCost() && (contexts || stats.LengthLimitCost() > 0),
+              std::string("cost of the length limit") + (contexts ? " with contexts" : ""));
+    }
+
+    limited.SetContexts(false);
+    Compress(limited, MakeRandom(200000, 3));
+    Check(limited.GetLengthLimitCost() == 0, "cost of the length limit of a stored block");
+
+    /** An unknown version is not guessed at */
+    BytesType unknown = ReadFile(res + "/sample.v3.huf");
+    unknown[3] = 9;
+
+    BytesType decompressed;
+    Check(! Decompress(huffman, unknown, decompressed), "unknown format version taken");
+}
+
+/** Each kind of block, flagged in its header */
+static void
+Flags(void)
+{
+    const BytesType text = MakeText(200000, 1);
+
+    {
+        Huffman huffman;
+        huffman.SetBlockSize(1 << 16);
+        RoundTrip(huffman, text, "plain", 0);
+        RoundTrip(huffman, BytesType(70000, 'x'), "one run", 0);
+    }
+
+    {
+        Huffman huffman;
+        huffman.SetBlockSize(1 << 16);
+        huffman.SetLengthBuckets(true);
+        RoundTrip(huffman, text, "bucketed", Huffman::block_bucketed);
+        RoundTrip(huffman, BytesType(1 << 20, 'x'), "one bucketed run", Huffman::block_bucketed);
+    }
+
+    {
+        Huffman huffman;
+        huffman.SetBlockSize(1 << 16);
+        huffman.SetInterleaved(true);
+        RoundTrip(huffman, text, "interleaved", Huffman::block_interleaved);
+    }
+
+    {
+        Huffman huffman;
+        huffman.SetBlockSize(1 << 16);
+        huffman.SetSampleStride(4);
+        RoundTrip(huffman, text, "sampled", Huffman::block_sampled | Huffman::block_bucketed);
+
+        huffman.SetInterleaved(true);
+        RoundTrip(huffman, text, "sampled and interleaved", Huffman::block_sampled | Huffman::block_bucketed | Huffman::block_interleaved);
+    }
+
+    {
+        Huffman huffman;
+        huffman.SetBlockSize(1 << 16);
+        huffman.SetContexts(true);
+        RoundTrip(huffman, MakeRecords(200000, 2), "contexts", Huffman::block_contexts | Huffman::block_bucketed);
+    }
+
+    {
+        /** Bytes with nothing to tell about the next; the tables of the contexts lose to one table of the block */
+        Random random(6);
+        BytesType unrelated(200000);
+
+        for(auto & byte : unrelated)
+            byte = uint8_t('a' + random.Below(16));
+
+        /** A block with tables is neither interleaved nor sampled; a block coded as usual is, as it is set */
+        Huffman huffman;
+        huffman.SetBlockSize(1 << 16);
+        huffman.SetContexts(true);
+        huffman.SetInterleaved(true);
+        RoundTrip(huffman, MakeRecords(200000, 2), "contexts before interleaved", Huffman::block_contexts | Huffman::block_bucketed);
+        RoundTrip(huffman, unrelated, "interleaved instead of contexts", Huffman::block_interleaved);
+
+        huffman.SetInterleaved(false);
+        huffman.SetSampleStride(4);
+        RoundTrip(huffman, MakeRecords(200000, 2), "contexts before sampled", Huffman::block_contexts | Huffman::block_bucketed);
+        RoundTrip(huffman, unrelated, "sampled instead of contexts", Huffman::block_sampled | Huffman::block_bucketed);
+    }
+
+    {
+        Huffman huffman;
+        huffman.SetBlockSize(1 << 16);
+        RoundTrip(huffman, MakeRandom(200000, 3), "stored", Huffman::block_stored);
+
+        huffman.SetInterleaved(true);
+        RoundTrip(huffman, MakeRandom(200000, 4), "stored instead of interleaved", Huffman::block_stored);
+
+        huffman.SetSampleStride(4);
+        RoundTrip(huffman, MakeRandom(200000, 5), "stored from a sample", Huffman::block_stored);
+    }
+}
+
+/** Small messages, coded with a codebook trained on others */
+static void
+Codebooks(void)
+{
+    std::vector<BytesType> samples;
+    std::vector<std::pair<const Huffman::ByteType *, Huffman::SizeType> > ranges;
+
+    for(uint32_t seed = 10; seed < 60; ++seed)
+        samples.push_back(MakeText(256, seed));
+
+    for(const auto & sample : samples)
+        ranges.push_back(std::make_pair(sample.data(), sample.size()));
+
+    Huffman huffman;
+    Codebook codebook;
+    huffman.Train(ranges, codebook);
+    Check(! codebook.empty(), "codebook not trained");
+
+    /** A codebook read back from its file codes the same */
+    std::stringstream file;
+    Codebook read;
+    Check(huffman.WriteCodebook(file, codebook), "codebook written");
+    Check(huffman.ReadCodebook(file, read) && read.GetId() == codebook.GetId(), "codebook read back");
+
+    const BytesType message = MakeText(256, 99);
+
+    std::istringstream fin(ToString(message));
+    std::ostringstream fout;
+    Check(huffman.Compress(fin, fout, codebook), "compression with a codebook");
+
+    const BytesType compressed = ToBytes(fout.str());
+    Check(Version(compressed) == Huffman::codebook_version, "codebook format version");
+    Check(compressed.size() < message.size(), "codebook does not shrink the message");
+
+    BytesType out(message.size());
+    Check(huffman.Decompress(compressed.data(), compressed.size(), out.data(), out.size(), read) && out == message, "codebook round trip");
+
+    /** Without the codebook, or with another one, the message is not decoded */
+    Codebook other;
+    samples.assign(1, MakeRecords(4096, 5));
+    ranges.assign(1, std::make_pair(samples[0].data(), samples[0].size()));
+    huffman.Train(ranges, other);
+
+    Check(! huffman.Decompress(compressed.data(), compressed.size(), out.data(), out.size()), "decoded without its codebook");
+    Check(! huffman.Decompress(compressed.data(), compressed.size(), out.data(), out.size(), other), "decoded with another codebook");
+
+    /** An input the codebook would not shrink is compressed as usual */
+    const BytesType noise = MakeRandom(256, 6);
+    Huffman::SizeType len = huffman.Compress(noise.data(), noise.size(), out.data(), 0, codebook);
+    Check(len == 0, "codebook compression into no memory");
+
+    BytesType bounded(huffman.CompressBound(noise.size(), codebook));
+    len = huffman.Compress(noise.data(), noise.size(), bounded.data(), bounded.size(), codebook);
+    bounded.resize(len);
+
+    BytesType decompressed;
+    Check(len > 0 && Version(bounded) == Huffman::format_version, "noise compressed as usual");
+    Check(Decompress(huffman, bounded, decompressed) && decompressed == noise, "noise round trip");
+}
+
+/** One-pass adaptive codes, as a whole and as a live stream */
+static void
+Adaptive(void)
+{
+    const BytesType text = MakeText(300000, 7);
+
+    Huffman huffman;
+    huffman.SetAdaptive(true);
+
+    BytesType compressed = Compress(huffman, text);
+    BytesType decompressed;
+    Huffman decoder;
+
+    Check(Version(compressed) == Huffman::adaptive_version, "adaptive format version");
+    Check(compressed.size() < text.size(), "adaptive codes do not shrink text");
+    Check(Decompress(decoder, compressed, decompressed) && decompressed == text, "adaptive round trip");
+
+    /** What is written before a flush decodes as soon as it is flushed, from a pipe too */
+    std::ostringstream fout;
+    AdaptiveEncoder encoder(fout);
+
+    Check(encoder.Write(text.data(), 1000) && encoder.Flush(), "adaptive write and flush");
+
+    const BytesType flushed = ToBytes(fout.str());
+    Check(encoder.Size() == flushed.size(), "adaptive size");
+
+    PipeBuffer pipe(flushed);
+    std::istream fin(&pipe);
+    std::ostringstream partial;
+
+    Check(! decoder.Decompress(fin, partial), "unclosed adaptive stream taken as whole");
+    Check(ToBytes(partial.str()) == BytesType(text.begin(), text.begin() + 1000), "flushed runs not decoded");
+
+    Check(encoder.Write(text.data() + 1000, text.size() - 1000) && encoder.Flush() && encoder.Close(), "adaptive write and close");
+    Check(! encoder.Write(text.data(), 1), "write after close taken");
+
+    Check(Decompress(decoder, ToBytes(fout.str()), decompressed) && decompressed == text, "flushed adaptive round trip");
+}
+
+/** Ranges of a stream, seekable or not, across blocks and past its end */
+static void
+Ranges(const std::string & res)
+{
+    const BytesType text = MakeText(500000, 8);
+
+    Huffman huffman;
+    huffman.SetBlockSize(1 << 16);
+    huffman.SetInterleaved(true);
+
+    const BytesType compressed = Compress(huffman, text);
+
+    const Huffman::SizeType ranges[][2] =
+    {
+        { 0, 10 }, { 65530, 20 }, { 100000, 300000 }, { 499990, 100 }, { 600000, 10 }, { 1234, 0 }, { 0, 500000 }
+    };
+
+    for(Huffman::SizeType threads : { 1, 3 })
+    {
+        huffman.SetThreadCount(threads);
+        huffman.SetBlockCacheSize(threads == 1 ? 0 : 4);
+
+        for(const auto & range : ranges)
+        {
+            const Huffman::SizeType offset = std::min(range[0], text.size());
+            const Huffman::SizeType length = std::min(range[1], text.size() - offset);
+            const BytesType expected(text.begin() + offset, text.begin() + offset + length);
+
+            const std::string what = "range " + std::to_string(range[0]) + ":" + std::to_string(range[1]);
+
+            std::istringstream fin(ToString(compressed));
+            std::ostringstream fout;
+            Check(huffman.DecompressRange(fin, range[0], range[1], fout) && ToBytes(fout.str()) == expected, what);
+
+            PipeBuffer pipe(compressed);
+            std::istream piped(&pipe);
+            std::ostringstream piped_out;
+            Check(huffman.DecompressRange(piped, range[0], range[1], piped_out) && ToBytes(piped_out.str()) == expected, what + " of a pipe");
+        }
+    }
+
+    /** Ranges of the formats with no blocks are decoded from the start */
+    const BytesType sample = ReadFile(res + "/sample.txt");
+
+    std::istringstream fin(ToString(ReadFile(res + "/sample.v1.huf")));
+    std::ostringstream fout;
+    Check(huffman.DecompressRange(fin, 10, 20, fout) && ToBytes(fout.str()) == BytesType(sample.begin() + 10, sample.begin() + 30), "range of an unframed stream");
+
+    huffman.SetAdaptive(true);
+    const BytesType adaptive = Compress(huffman, text);
+
+    std::istringstream adaptive_in(ToString(adaptive));
+    std::ostringstream adaptive_out;
+    Check(huffman.DecompressRange(adaptive_in, 70000, 5000, adaptive_out) && ToBytes(adaptive_out.str()) == BytesType(text.begin() + 70000, text.begin() + 75000), "range of an adaptive stream");
+}
+
+/** Truncated and damaged input; a truncation always fails, and nothing crashes */
+static void
+Damaged(const std::string & res)
+{
+    std::vector<std::pair<std::string, BytesType> > streams;
+
+    for(int version : { 1, 2, 3, 5 })
+    {
+        const std::string name = "sample.v" + std::to_string(version) + ".huf";
+        streams.push_back(std::make_pair(name, ReadFile(res + "/" + name)));
+    }
+
+    const BytesType text = MakeText(100000, 9);
+
+    {
+        Huffman huffman;
+        huffman.SetBlockSize(1 << 14);
+        streams.push_back(std::make_pair("plain", Compress(huffman, text)));
+
+        huffman.SetInterleaved(true);
+        huffman.SetSampleStride(4);
+        streams.push_back(std::make_pair("sampled and interleaved", Compress(huffman, text)));
+
+        huffman.SetInterleaved(false);
+        huffman.SetSampleStride(1);
+        huffman.SetContexts(true);
+        streams.push_back(std::make_pair("contexts", Compress(huffman, MakeRecords(100000, 10))));
+
+        huffman.SetContexts(false);
+        streams.push_back(std::make_pair("stored", Compress(huffman, MakeRandom(100000, 11))));
+
+        huffman.SetAdaptive(true);
+        streams.push_back(std::make_pair("adaptive", Compress(huffman, text)));
+    }
+
+    for(const auto & stream : streams)
+    {
+        const BytesType & whole = stream.second;
+
+        for(Huffman::SizeType threads : { 1, 3 })
+        {
+            Huffman huffman;
+            huffman.SetThreadCount(threads);
+
+            BytesType out;
+
+            /** The unframed format dropped the zero bytes of its last codeword buffer; a cut there cannot be told apart */
+            const size_t end = whole.size() - (stream.first == "sample.v1.huf" ? 3 : 0);
+
+            /** Every cut in the first bytes and the last ones, and a few in between; no bytes at all is an empty legacy stream */
+            for(size_t len = 1; len < end; len += (len < 64 || end - len < 64) ? 1 : whole.size() / 37)
+            {
+                const BytesType cut(whole.begin(), whole.begin() + len);
+                const std::string what = stream.first + " cut to " + std::to_string(len) + " bytes";
+
+                Check(! Decompress(huffman, cut, out), what + ": taken");
+
+                Huffman::SizeType size = 0;
+                if(huffman.GetDecompressedSize(cut.data(), cut.size(), size) && size < (1 << 24))
+                {
+                    out.resize(size);
+                    Check(! huffman.Decompress(cut.data(), cut.size(), out.data(), out.size()), what + ": taken from memory");
+                }
+            }
+
+            /** Flipped bytes may decode to other bytes, as there is no checksum, but must not crash */
+            Random random(uint32_t(whole.size()));
+
+            for(int i = 0; i < 200; ++i)
+            {
+                BytesType damaged = whole;
+                damaged[random.Below(uint32_t(damaged.size()))] ^= uint8_t(1 + random.Below(255));
+
+                Decompress(huffman, damaged, out);
+
+                Huffman::SizeType size = 0;
+                if(huffman.GetDecompressedSize(damaged.data(), damaged.size(), size) && size < (1 << 24))
+                {
+                    out.resize(size);
+                    huffman.Decompress(damaged.data(), damaged.size(), out.data(), out.size());
+                }
+            }
+        }
+    }
+
+    /** A magic that is not ours */
+    BytesType foreign = ToBytes("GIF89a, not a huffman stream");
+    BytesType out;
+
+    Huffman huffman;
+    Check(! Decompress(huffman, foreign, out), "foreign input taken");
+}
+
+/** Stages of the pipeline that throw; the call throws, and the coder can be used again */
+static void
+Pipeline(void)
+{
+    const BytesType text = MakeText(4 << 20, 12);
+
+    for(Huffman::SizeType threads : { 1, 3 })
+    {
+        Huffman huffman;
+        huffman.SetThreadCount(threads);
+        huffman.SetBlockSize(1 << 16);
+        huffman.SetPipelined(true);
+
+        const std::string what = std::to_string(threads) + " thread(s)";
+
+        BytesType pipelined = Compress(huffman, text);
+
+        huffman.SetPipelined(false);
+        Check(Compress(huffman, text) == pipelined, what + ": pipelining changes the output");
+        huffman.SetPipelined(true);
+
+        {
+            std::istringstream fin(ToString(text));
+            FailingOutput failing(100000);
+            std::ostream fout(&failing);
+            fout.exceptions(std::ios::badbit);
+
+            bool thrown = false;
+            try
+            {
+                huffman.Compress(fin, fout);
+            }
+            catch(const std::runtime_error &)
+            {
+                thrown = true;
+            }
+
+            Check(thrown, what + ": failed output not thrown");
+        }
+
+        {
+            FailingInput failing(1 << 20);
+            std::istream fin(&failing);
+            fin.exceptions(std::ios::badbit);
+            std::ostringstream fout;
+
+            bool thrown = false;
+            try
+            {
+                huffman.Compress(fin, fout);
+            }
+            catch(const std::runtime_error &)
+            {
+                thrown = true;
+            }
+
+            Check(thrown, what + ": failed input not thrown");
+        }
+
+        BytesType decompressed;
+        Check(Compress(huffman, text) == pipelined, what + ": output changed after a failure");
+        Check(Decompress(huffman, pipelined, decompressed) && decompressed == text, what + ": round trip after a failure");
+    }
+}
+
+int
+main(const int argc, char * const argv[])
+{
+    if(argc < 2)
+    {
+        std::cerr << "usage: " << argv[0] << " formats|flags|codebook|adaptive|range|damaged|pipeline [RESOURCE DIRECTORY]" << std::endl;
+        return 2;
+    }
+
+    const std::string group = argv[1];
+    const std::string res = argc > 2 ? argv[2] : "res";
+
+    if(group == "formats")
+        Formats(res);
+    else if(group == "flags")
+        Flags();
+    else if(group == "codebook")
+        Codebooks();
+    else if(group == "adaptive")
+        Adaptive();
+    else if(group == "range")
+        Ranges(res);
+    else if(group == "damaged")
+        Damaged(res);
+    else if(group == "pipeline")
+        Pipeline();
+    else
+    {
+        std::cerr << "unknown group: " << group << std::endl;
+        return 2;
+    }
+
+    if(failures > 0)
+        std::cerr << failures << " check(s) failed" << std::endl;
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,145 @@
+#ifndef ALGORITHM_MAPPEDFILE_H_
+#define ALGORITHM_MAPPEDFILE_H_ 1
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace algorithm
+{
+
+/** \brief  Regular file mapped into memory
+
+    Only regular files are mapped; Open and Create fail for pipes and
+    special files, so that the caller falls back to the streams.
+    An empty file is not mapped, and has no data.
+*/
+class MappedFile
+{
+public:
+    typedef size_t          SizeType;
+    typedef uint8_t         ByteType;
+
+private:
+    int                     fd_;
+    ByteType *              data_;
+    SizeType                size_;
+
+    bool
+    Map(const int & prot)
+    {
+        if(size_ == 0)
+            return true;
+
+        void * data = mmap(nullptr, size_, prot, MAP_SHARED, fd_, 0);
+        if(data == MAP_FAILED)
+            return false;
+
+        data_ = (ByteType *)data;
+
+        /** The coder runs through the file front to back */
+        madvise(data_, size_, MADV_SEQUENTIAL);
+
+        return true;
+    }
+
+    MappedFile(const MappedFile &);
+    MappedFile & operator=(const MappedFile &);
+
+public:
+    MappedFile(void)
+    : fd_       (-1)
+    , data_     (nullptr)
+    , size_     (0)
+    {}
+
+    ~MappedFile(void)
+    { Close(); }
+
+    /** Map an existing regular file for reading */
+    bool
+    Open(const std::string & path)
+    {
+        Close();
+
+        fd_ = open(path.c_str(), O_RDONLY);
+        if(fd_ < 0)
+            return false;
+
+        struct stat st;
+        if(fstat(fd_, &st) != 0 || ! S_ISREG(st.st_mode))
+        {
+            Close();
+            return false;
+        }
+
+        size_ = SizeType(st.st_size);
+
+        if(! Map(PROT_READ))
+        {
+            Close();
+            return false;
+        }
+
+        return true;
+    }
+
+    /** Create, or truncate, a regular file of `size' bytes and map it for writing */
+    bool
+    Create(const std::string & path, const SizeType & size)
+    {
+        Close();
+
+        /** Do not truncate what cannot be mapped, such as a device */
+        struct stat st;
+        if(stat(path.c_str(), &st) == 0 && ! S_ISREG(st.st_mode))
+            return false;
+
+        fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+        if(fd_ < 0)
+            return false;
+
+        size_ = size;
+
+        if(ftruncate(fd_, off_t(size_)) != 0 || ! Map(PROT_READ | PROT_WRITE))
+        {
+            Close();
+            return false;
+        }
+
+        return true;
+    }
+
+    void
+    Close(void)
+    {
+        if(data_ != nullptr)
+            munmap(data_, size_);
+
+        if(fd_ >= 0)
+            close(fd_);
+
+        fd_     = -1;
+        data_   = nullptr;
+        size_   = 0;
+    }
+
+    ByteType *
+    Data(void)
+    const
+    { return data_; }
+
+    SizeType
+    Size(void)
+    const
+    { return size_; }
+};
+
+} /** ns: algorithm */
+
+#endif /** ! ALGORITHM_MAPPEDFILE_H_ */
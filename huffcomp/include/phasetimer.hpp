@@ -0,0 +1 @@
+../../libhuffman/include/phasetimer.hpp
\ No newline at end of file
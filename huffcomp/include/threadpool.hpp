@@ -0,0 +1 @@
+../../libhuffman/include/threadpool.hpp
\ No newline at end of file
@@ -1,13 +1,32 @@
 #include "huffman.hpp"
+#include "mappedfile.hpp"
+#include "threadpool.hpp"
+#include "phasetimer.hpp"
 
 #include <iostream>
+#include <iomanip>
 #include <fstream>
+#include <iterator>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <thread>
 #include <cstring>
+#include <cstdlib>
 
 #include <getopt.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
 
 using namespace algorithm;
 
+/** Appended to the name of each file compressed in batch, and taken off again when it is decompressed */
+static const std::string    suffix = ".huf";
+
 struct Msg
 {
     static void
@@ -16,7 +35,12 @@ struct Msg
 
     static void
     Usage(std::ostream & out, const std::string & this_file)
-    { out << "Usage: " << this_file << " [OPTION]... [INPUT FILENAME]\n"; }
+    { out << "Usage: " << this_file << " [OPTION]... [INPUT FILENAME]\n"
+          << "  or:  " << this_file << " [OPTION]... FILENAME|DIRECTORY...\n"
+          << "  or:  " << this_file << " --train [OPTION]... SAMPLE FILENAME...\n"
+          << "With no INPUT FILENAME, or when it is -, read standard input.\n"
+          << "With many FILENAMEs, or -r, each file is compressed to FILENAME" << suffix << " beside it,\n"
+          << "or decompressed from it, and the throughput of all of them printed to stderr.\n"; }
 
     static void
     Help(std::ostream & out, const std::string & this_file)
@@ -29,7 +53,50 @@ struct Msg
             << "  -h,  --help                      print this help\n"
             << "  -c,  --compress                  compress with huffman coding (this is the default)\n"
             << "  -d,  --decompress                decompress with huffman decoding\n"
-            << "  -o,  --output-file=FILENAME      specify the output path (default is stdout)\n";
+            << "  -o,  --output-file=FILENAME      specify the output path (default is stdout)\n"
+            << "  -l,  --length-limit=BITS         limit the length of codewords (default is 32)\n"
+            << "  -b,  --block-size=BYTES          code the input in blocks of BYTES (default is 1048576)\n"
+            << "  -B,  --length-buckets            code run lengths as length codes with extra bits\n"
+            << "  -I,  --interleave                deal the codewords of each block to 4 bitstreams, to decode faster\n"
+            << "  -s,  --sample=N                  build the code of each block from 1 in N of its 16 KiB chunks,\n"
+            << "                                   to count the runs faster; implies -B (default is 1, every chunk)\n"
+            << "  -C,  --contexts                  code the runs after each symbol with a table of their own,\n"
+            << "                                   when it shrinks the block; implies -B\n"
+            << "  -T,  --threads=N                 code N blocks at once, or N files at once with many files;\n"
+            << "                                   0 is one for each core (default is 1)\n"
+            << "  -r,  --recursive                 code the files in each DIRECTORY, and in the directories below it\n"
+            << "  -A,  --adaptive                  compress in one pass with adaptive codes; standard input\n"
+            << "                                   is sent on whenever it stops short of a full chunk\n"
+            << "       --no-pipeline               read and write a single stream on the coding thread\n"
+            << "       --range=OFFSET:LENGTH       decompress only LENGTH bytes from OFFSET of the original\n"
+            << "       --train                     train a codebook on the SAMPLE FILENAMEs, and write it to the output\n"
+            << "       --codebook=FILENAME         compress or decompress with a trained codebook\n"
+            << "       --stats                     print the time of each phase, and the sizes and codes, to stderr\n";
+    }
+
+    static void
+    Stats(std::ostream & out, const Huffman::StatsType & stats, const bool & compress, const double & total_time)
+    {
+        out << std::fixed << std::setprecision(6)
+            << "collect runs             " << stats.collect_runs_time << " s\n"
+            << "create tree              " << stats.create_tree_time << " s\n"
+            << "header                   " << stats.header_time << " s\n"
+            << "encode                   " << stats.encode_time << " s\n"
+            << "decode                   " << stats.decode_time << " s\n"
+            << "total                    " << total_time << " s\n";
+
+        if(compress)
+        {
+            out << "bytes in                 " << stats.bytes_in << "\n"
+                << "bytes out                " << stats.bytes_out << std::setprecision(2)
+                << " (" << (stats.bytes_in > 0 ? 100.0 * double(stats.bytes_out) / double(stats.bytes_in) : 0.0) << "%)\n"
+                << "stored blocks            " << stats.stored_block_count << "\n"
+                << "runs                     " << stats.run_count << "\n"
+                << "meta-symbols             " << stats.meta_symbol_count << "\n"
+                << "codeword length max      " << stats.codeword_len_max << "\n"
+                << "codeword length average  " << stats.AverageCodewordLength() << "\n"
+                << "length limit cost        " << 100.0 * stats.LengthLimitCost() << "%\n";
+        }
     }
 
     static void
@@ -53,10 +120,51 @@ struct Msg
         InvalidOption(out, this_file);
     }
 
+    static void
+    InvalidRange(std::ostream & out, const std::string & this_file, const std::string & range)
+    {
+        out << this_file << ": invalid range `" << range << "'\n";
+        InvalidOption(out, this_file);
+    }
+
+    static void
+    IsDirectory(std::ostream & out, const std::string & path)
+    { out << path << ": is a directory -- ignored\n"; }
+
+    static void
+    HasSuffix(std::ostream & out, const std::string & path)
+    { out << path << ": already has " << suffix << " suffix -- unchanged\n"; }
+
+    static void
+    UnknownSuffix(std::ostream & out, const std::string & path)
+    { out << path << ": unknown suffix -- ignored\n"; }
+
+    static void
+    Throughput(std::ostream & out, const size_t & files, const size_t & failed, const size_t & bytes_in, const size_t & bytes_out,
+               const bool & compress, const double & total_time)
+    {
+        /** The speed is of the uncompressed bytes, either way */
+        const size_t raw = compress ? bytes_in : bytes_out;
+
+        out << files << " files, " << failed << " failed, " << bytes_in << " bytes in, " << bytes_out << " bytes out"
+            << std::fixed << std::setprecision(2)
+            << " (" << (bytes_in > 0 ? 100.0 * double(bytes_out) / double(bytes_in) : 0.0) << "%), "
+            << std::setprecision(3) << total_time << " s, "
+            << std::setprecision(2) << (total_time > 0 ? double(raw) / 1e6 / total_time : 0.0) << " MB/s\n";
+    }
+
+    static void
+    InvalidCodebook(std::ostream & out, const std::string & path)
+    { out << path << ": not a codebook, or a damaged one\n"; }
+
     static void
     CannotOpenFile(std::ostream & out, const std::string & fin_path)
     { out << fin_path << ": " << strerror(ENOENT) << "\n"; }
     
+    static void
+    CannotWriteFile(std::ostream & out, const std::string & fout_path)
+    { out << fout_path << ": " << strerror(EIO) << "\n"; }
+
     static void
     CompressFailed(std::ostream & out, const std::string & path)
     { out << "Cannot compress file " << path << ".\n"; }
@@ -66,14 +174,184 @@ struct Msg
     { out << "Cannot decompress file " << path << ".\n"; }
 };
 
+static bool
+IsDirectory(const std::string & path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/** Add the regular files at `path' to `files'; with `recursive', those in a directory, and in the directories below it.
+    Symbolic links are followed for the paths given, and not below them. False when a given path is not found.
+*/
+static bool
+CollectFiles(const std::string & path, const bool & recursive, const bool & given, std::vector<std::string> & files)
+{
+    struct stat st;
+    if((given ? stat(path.c_str(), &st) : lstat(path.c_str(), &st)) != 0)
+    {
+        Msg::CannotOpenFile(std::cerr, path);
+        return false;
+    }
+
+    if(S_ISREG(st.st_mode))
+        files.push_back(path);
+    else if(S_ISDIR(st.st_mode) && ! recursive)
+        Msg::IsDirectory(std::cerr, path);
+    else if(S_ISDIR(st.st_mode))
+    {
+        DIR * dir = opendir(path.c_str());
+        if(dir == nullptr)
+        {
+            Msg::CannotOpenFile(std::cerr, path);
+            return false;
+        }
+
+        /** In order of the names, so that the files are coded in the same order on every run */
+        std::vector<std::string> names;
+
+        for(struct dirent * entry = readdir(dir); entry != nullptr; entry = readdir(dir))
+            if(std::strcmp(entry->d_name, ".") != 0 && std::strcmp(entry->d_name, "..") != 0)
+                names.push_back(entry->d_name);
+
+        closedir(dir);
+        std::sort(names.begin(), names.end());
+
+        bool found = true;
+        for(const auto & name : names)
+            found = CollectFiles(path + (path[path.size() - 1] == '/' ? "" : "/") + name, recursive, false, files) && found;
+
+        return found;
+    }
+
+    return true;
+}
+
+/** Compress, or decompress, the regular file at `fin_path' into `fout_path', with the settings of `huffman';
+    the sizes of both are added to `bytes_in' and `bytes_out'. False when either cannot be opened, or the input not decoded;
+    the output is removed then.
+*/
+static bool
+CodeFile(Huffman & huffman, const Codebook & codebook, const bool & compress, const std::string & fin_path, const std::string & fout_path,
+         size_t & bytes_in, size_t & bytes_out)
+{
+    MappedFile fin_map;
+    if(! fin_map.Open(fin_path))
+        return false;
+
+    if(compress)
+    {
+        std::ofstream fout(fout_path, std::ios::binary);
+        if(! fout.is_open())
+            return false;
+
+        bool compressed = codebook.empty()
+                        ? huffman.Compress(fin_map.Data(), fin_map.Size(), fout)
+                        : huffman.Compress(fin_map.Data(), fin_map.Size(), fout, codebook);
+
+        bytes_in    += fin_map.Size();
+        bytes_out   += size_t(fout.tellp());
+
+        fout.close();
+        if(! compressed || fout.fail())
+        {
+            unlink(fout_path.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    /** The output is presized to the uncompressed size; the adaptive format is not sized, and is decoded from a stream */
+    MappedFile          fout_map;
+    Huffman::SizeType   fout_size = 0;
+
+    if(huffman.GetDecompressedSize(fin_map.Data(), fin_map.Size(), fout_size) && fout_map.Create(fout_path, fout_size))
+    {
+        bool decompressed = codebook.empty()
+                          ? huffman.Decompress(fin_map.Data(), fin_map.Size(), fout_map.Data(), fout_map.Size())
+                          : huffman.Decompress(fin_map.Data(), fin_map.Size(), fout_map.Data(), fout_map.Size(), codebook);
+
+        bytes_in    += fin_map.Size();
+        bytes_out   += fout_map.Size();
+
+        if(! decompressed)
+        {
+            fout_map.Close();
+            unlink(fout_path.c_str());
+        }
+
+        return decompressed;
+    }
+
+    std::ifstream fin(fin_path, std::ios::binary);
+    std::ofstream fout(fout_path, std::ios::binary);
+    if(! fin.is_open() || ! fout.is_open())
+        return false;
+
+    bool decompressed = codebook.empty()
+                      ? huffman.Decompress(fin, fout)
+                      : huffman.Decompress(fin, fout, codebook);
+
+    bytes_in    += fin_map.Size();
+    bytes_out   += size_t(fout.tellp());
+
+    fout.close();
+    if(! decompressed || fout.fail())
+    {
+        unlink(fout_path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
 int
 main(const int argc, char * const argv[])
 {
     int retval = 0;
 
     std::string fin_path;
+    std::vector<std::string> fin_paths;
     std::string fout_path;
     bool compress = true;
+    int length_limit = Huffman::codeword_len_max;
+    long block_size = Huffman::block_size_default;
+    bool length_buckets = false;
+    bool interleaved = false;
+    long sample_stride = 1;
+    bool contexts = false;
+    bool adaptive = false;
+    bool pipelined = true;
+    int thread_count = 1;
+    bool recursive = false;
+    bool range = false;
+    unsigned long long range_offset = 0;
+    unsigned long long range_length = 0;
+    bool train = false;
+    std::vector<std::string> sample_paths;
+    std::string codebook_path;
+    Codebook codebook;
+    bool print_stats = false;
+    bool stats_started = false;
+    Huffman::StatsType stats;
+    std::chrono::steady_clock::time_point start;
+
+    /** Standard streams get buffers of their own, which also tell how much of a pipe has come in */
+    std::ios::sync_with_stdio(false);
+
+    /** The settings of the coders that compress */
+    auto configure = [&](Huffman & huffman)
+    {
+        huffman.SetCodewordLengthLimit(length_limit);
+        huffman.SetBlockSize(block_size);
+        huffman.SetLengthBuckets(length_buckets);
+        huffman.SetInterleaved(interleaved);
+        huffman.SetSampleStride(sample_stride < 1 ? 1 : sample_stride);
+        huffman.SetContexts(contexts);
+        huffman.SetThreadCount(thread_count);
+        huffman.SetAdaptive(adaptive);
+    };
 
     {
         /** getopt(3) */
@@ -90,10 +368,25 @@ main(const int argc, char * const argv[])
                 { "compress",       no_argument,        nullptr, 'c' },
                 { "decompress",     no_argument,        nullptr, 'd' },
                 { "help",           no_argument,        nullptr, 'h' },
-                { "output-file",    required_argument,  nullptr, 'o' }
+                { "output-file",    required_argument,  nullptr, 'o' },
+                { "length-limit",   required_argument,  nullptr, 'l' },
+                { "block-size",     required_argument,  nullptr, 'b' },
+                { "length-buckets", no_argument,        nullptr, 'B' },
+                { "interleave",     no_argument,        nullptr, 'I' },
+                { "sample",         required_argument,  nullptr, 's' },
+                { "contexts",       no_argument,        nullptr, 'C' },
+                { "threads",        required_argument,  nullptr, 'T' },
+                { "recursive",      no_argument,        nullptr, 'r' },
+                { "adaptive",       no_argument,        nullptr, 'A' },
+                { "no-pipeline",    no_argument,        nullptr, 'P' },
+                { "range",          required_argument,  nullptr, 'R' },
+                { "train",          no_argument,        nullptr, 't' },
+                { "codebook",       required_argument,  nullptr, 'k' },
+                { "stats",          no_argument,        nullptr, 'S' },
+                { nullptr,          0,                  nullptr, 0   }
             };
 
-            c = getopt_long(argc, argv, "cdho:", options, &option_index);
+            c = getopt_long(argc, argv, "cdho:l:b:BIs:CT:rA", options, &option_index);
 
             if(c == -1)
                 break;
@@ -112,6 +405,82 @@ main(const int argc, char * const argv[])
                 fout_path = optarg;
                 break;
 
+            case 'l': /** --length-limit */
+                length_limit = atoi(optarg);
+                break;
+
+            case 'b': /** --block-size */
+                block_size = atol(optarg);
+                break;
+
+            case 'B': /** --length-buckets */
+                length_buckets = true;
+                break;
+
+            case 'I': /** --interleave */
+                interleaved = true;
+                break;
+
+            case 's': /** --sample */
+                sample_stride = atol(optarg);
+                break;
+
+            case 'C': /** --contexts */
+                contexts = true;
+                break;
+
+            case 'T': /** --threads */
+                thread_count = atoi(optarg);
+                break;
+
+            case 'r': /** --recursive */
+                recursive = true;
+                break;
+
+            case 'A': /** --adaptive */
+                adaptive = true;
+                break;
+
+            case 'P': /** --no-pipeline */
+                pipelined = false;
+                break;
+
+            case 'R': /** --range */
+            {
+                char * delim = nullptr;
+                char * end = nullptr;
+
+                range_offset = strtoull(optarg, &delim, 10);
+                if(delim == optarg || *delim != ':')
+                {
+                    Msg::InvalidRange(std::cout, argv[0], optarg);
+                    goto jump_exit;
+                }
+
+                range_length = strtoull(delim + 1, &end, 10);
+                if(end == delim + 1 || *end != '\0')
+                {
+                    Msg::InvalidRange(std::cout, argv[0], optarg);
+                    goto jump_exit;
+                }
+
+                range = true;
+                compress = false;
+                break;
+            }
+
+            case 't': /** --train */
+                train = true;
+                break;
+
+            case 'k': /** --codebook */
+                codebook_path = optarg;
+                break;
+
+            case 'S': /** --stats */
+                print_stats = true;
+                break;
+
             case 'h': /** --help */
                 Msg::Help(std::cout, argv[0]);
                 goto jump_exit;
@@ -125,74 +494,389 @@ main(const int argc, char * const argv[])
             }
         }
 
-        if(optind + 1 == argc) /** Only one argument except options */
-            fin_path = argv[optind];
-        else
+        if(train) /** Every argument except options is a sample */
         {
-            if(argc > 2)
-                Msg::TooManyArguments(std::cout, argv[0]);
-            else
-                Msg::ArgumentNotProvided(std::cout, argv[0]);
+            for(; optind < argc; ++optind)
+                sample_paths.push_back(argv[optind]);
 
+            if(sample_paths.empty())
+            {
+                Msg::ArgumentNotProvided(std::cout, argv[0]);
+                goto jump_exit;
+            }
+        }
+        else if(optind + 1 == argc && ! recursive && ! IsDirectory(argv[optind])) /** Only one argument except options */
+            fin_path = argv[optind];
+        else if(optind < argc && ! range && fout_path.empty()) /** Each file is coded beside itself */
+        {
+            for(; optind < argc; ++optind)
+                fin_paths.push_back(argv[optind]);
+        }
+        else if(optind < argc)
+        {
+            Msg::TooManyArguments(std::cout, argv[0]);
             goto jump_exit;
         }
+
+        if(fin_path == "-")
+            fin_path.clear();
     }
 
-    if(compress)
+    if(! codebook_path.empty())
     {
-        /** Compression */
+        /** The codebook is read once, before any coding */
 
-        std::ifstream fin(fin_path, std::ios::binary);
-        if(! fin.is_open())
+        std::ifstream codebook_file(codebook_path, std::ios::binary);
+        if(! codebook_file.is_open())
         {
-            Msg::CannotOpenFile(std::cerr, fin_path);
-            Msg::CompressFailed(std::cerr, fin_path);
+            Msg::CannotOpenFile(std::cerr, codebook_path);
 
             retval = ENOENT;
             goto jump_exit;
         }
 
         Huffman huffman;
+        if(! huffman.ReadCodebook(codebook_file, codebook))
+        {
+            Msg::InvalidCodebook(std::cerr, codebook_path);
+
+            retval = EINVAL;
+            goto jump_exit;
+        }
+    }
+
+    if(train)
+    {
+        /** Training */
+
+        Huffman huffman;
+        huffman.SetCodewordLengthLimit(length_limit);
+
+        std::vector<std::vector<uint8_t> > sample_data;
+        std::vector<std::pair<const Huffman::ByteType *, Huffman::SizeType> > samples;
+
+        for(const auto & path : sample_paths)
+        {
+            std::ifstream sample_file(path, std::ios::binary);
+            if(! sample_file.is_open())
+            {
+                Msg::CannotOpenFile(std::cerr, path);
+
+                retval = ENOENT;
+                goto jump_exit;
+            }
+
+            sample_data.push_back(std::vector<uint8_t>(std::istreambuf_iterator<char>(sample_file), std::istreambuf_iterator<char>()));
+        }
+
+        for(const auto & data : sample_data)
+            samples.push_back(std::make_pair(data.data(), data.size()));
+
+        huffman.Train(samples, codebook);
+
+        std::ofstream fout_file;
+        if(! fout_path.empty())
+            fout_file.open(fout_path, std::ios::binary);
+
+        std::ostream & fout = fout_path.empty() ? std::cout : fout_file;
+
+        if(! huffman.WriteCodebook(fout, codebook))
+        {
+            Msg::CannotWriteFile(std::cerr, fout_path.empty() ? "standard output" : fout_path);
+            retval = EIO;
+        }
+
+        fout_file.close();
+    }
+    else if(! fin_paths.empty())
+    {
+        /** Many files; each worker of a fixed pool takes the next file, and codes it with a coder of its own */
+
+        std::vector<std::string> files;
+        for(const auto & path : fin_paths)
+            if(! CollectFiles(path, recursive, true, files))
+                retval = ENOENT;
+
+        const size_t worker_count = thread_count > 0 ? size_t(thread_count) : std::max(1u, std::thread::hardware_concurrency());
+
+        std::atomic<size_t> next(0);
+        std::mutex          report;         /**< Guards stderr, and the totals */
+        size_t              coded       = 0;
+        size_t              failed      = 0;
+        size_t              bytes_in    = 0;
+        size_t              bytes_out   = 0;
+
+        std::vector<Huffman::StatsType> worker_stats(worker_count);
+
+        if(print_stats)
+            stats_started = true;
+
+        start = std::chrono::steady_clock::now();
+
+        {
+            ThreadPool                      pool(worker_count);
+            std::vector<std::future<void> > workers;
+
+            for(size_t worker = 0; worker < worker_count; ++worker)
+            {
+                workers.push_back(pool.Submit([&, worker]
+                {
+                    /** Reset between the files; the buffers grown for one are kept for the next */
+                    Huffman huffman;
+
+                    if(compress)
+                        configure(huffman);
+
+                    huffman.SetThreadCount(1);
+
+                    if(print_stats)
+                        huffman.SetStats(&worker_stats[worker]);
+
+                    for(size_t i = next++; i < files.size(); i = next++)
+                    {
+                        const std::string & path = files[i];
+                        const bool suffixed = path.size() > suffix.size() && path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0;
+
+                        if(compress == suffixed)
+                        {
+                            std::lock_guard<std::mutex> lock(report);
+
+                            if(compress)
+                                Msg::HasSuffix(std::cerr, path);
+                            else
+                                Msg::UnknownSuffix(std::cerr, path);
+
+                            continue;
+                        }
+
+                        size_t file_in  = 0;
+                        size_t file_out = 0;
+
+                        huffman.Reset();
+                        bool done = CodeFile(huffman, codebook, compress, path,
+                                             compress ? path + suffix : path.substr(0, path.size() - suffix.size()),
+                                             file_in, file_out);
+
+                        std::lock_guard<std::mutex> lock(report);
+
+                        if(! done)
+                        {
+                            ++failed;
+
+                            if(compress)
+                                Msg::CompressFailed(std::cerr, path);
+                            else
+                                Msg::DecompressFailed(std::cerr, path);
+                        }
+                        else
+                            ++coded;
+
+                        bytes_in    += file_in;
+                        bytes_out   += file_out;
+                    }
+                }));
+            }
+
+            for(auto & worker : workers)
+                worker.get();
+        }
+
+        for(const auto & worker : worker_stats)
+            stats += worker;
+
+        Msg::Throughput(std::cerr, coded, failed, bytes_in, bytes_out, compress,
+                        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+        if(failed > 0)
+            retval = EINVAL;
+    }
+    else if(compress)
+    {
+        /** Compression */
+
+        Huffman huffman;
+        configure(huffman);
+
+        /** One stream; it is read and written while its blocks are coded, unless told not to */
+        huffman.SetPipelined(pipelined);
+
+        if(print_stats)
+        {
+            huffman.SetStats(&stats);
+            stats_started = true;
+            start = std::chrono::steady_clock::now();
+        }
+
+        /** A regular file is mapped, and coded in place */
+        MappedFile fin_map;
+        bool mapped = ! fin_path.empty() && fin_map.Open(fin_path);
+
+        std::ifstream fin_file;
+        if(! mapped && ! fin_path.empty())
+        {
+            fin_file.open(fin_path, std::ios::binary);
+            if(! fin_file.is_open())
+            {
+                Msg::CannotOpenFile(std::cerr, fin_path);
+                Msg::CompressFailed(std::cerr, fin_path);
+
+                retval = ENOENT;
+                goto jump_exit;
+            }
+        }
+
+        /** Read standard input without a filename; it is never seeked */
+        std::istream & fin = fin_path.empty() ? std::cin : fin_file;
 
-        if(fout_path.empty())
-            huffman.Compress(fin, std::cout);
+        std::ofstream fout_file;
+        if(! fout_path.empty())
+            fout_file.open(fout_path, std::ios::binary);
+
+        std::ostream & fout = fout_path.empty() ? std::cout : fout_file;
+        bool compressed = true;
+
+        if(adaptive && codebook.empty() && fin_path.empty())
+        {
+            /** Whatever standard input has is coded at once; it is flushed when a read comes up short,
+                so that a live stream is not held back, while a full one is not padded chunk by chunk.
+                Only the encoder is timed, and not the waits for input
+            */
+            Huffman::StatsType * timed = print_stats ? &stats : nullptr;
+
+            std::vector<uint8_t> chunk(Huffman::chunk_size);
+            AdaptiveEncoder encoder(fout);
+
+            ssize_t len;
+            while(compressed && (len = read(STDIN_FILENO, chunk.data(), chunk.size())) > 0)
+            {
+                PhaseTimer timer(timed, &Huffman::StatsType::encode_time);
+
+                compressed = encoder.Write(chunk.data(), Huffman::SizeType(len))
+                          && (Huffman::SizeType(len) == chunk.size() || encoder.Flush());
+
+                stats.bytes_in += Huffman::SizeType(len);
+            }
+
+            {
+                PhaseTimer timer(timed, &Huffman::StatsType::encode_time);
+                compressed = encoder.Close() && compressed;
+            }
+
+            stats.bytes_out = encoder.Size();
+        }
+        else if(! codebook.empty() && mapped)
+            compressed = huffman.Compress(fin_map.Data(), fin_map.Size(), fout, codebook);
+        else if(! codebook.empty())
+            compressed = huffman.Compress(fin, fout, codebook);
+        else if(mapped)
+            compressed = huffman.Compress(fin_map.Data(), fin_map.Size(), fout);
         else
+            compressed = huffman.Compress(fin, fout);
+
+        if(! compressed || ! fout.flush().good())
         {
-            std::ofstream fout(fout_path, std::ios::binary);
-            huffman.Compress(fin, fout);
-            fout.close();
+            Msg::CompressFailed(std::cerr, fin_path.empty() ? "standard input" : fin_path);
+            retval = EIO;
         }
 
-        fin.close();
+        fout_file.close();
+        fin_file.close();
+
+        if(retval != 0 && ! fout_path.empty())
+            unlink(fout_path.c_str());
     }
     else
     {
         /** Decompression */
 
-        std::ifstream fin(fin_path, std::ios::binary);
-        if(! fin.is_open())
+        Huffman huffman;
+        huffman.SetThreadCount(thread_count);
+
+        if(print_stats)
         {
-            Msg::CannotOpenFile(std::cerr, fin_path);
-            Msg::DecompressFailed(std::cerr, fin_path);
+            huffman.SetStats(&stats);
+            stats_started = true;
+            start = std::chrono::steady_clock::now();
+        }
+
+        /** Regular files on both sides are mapped, and the output presized to the uncompressed size */
+        MappedFile fin_map;
+        MappedFile fout_map;
+        Huffman::SizeType fout_size = 0;
+
+        if(! range && ! fin_path.empty() && ! fout_path.empty()
+            && fin_map.Open(fin_path)
+            && huffman.GetDecompressedSize(fin_map.Data(), fin_map.Size(), fout_size)
+            && fout_map.Create(fout_path, fout_size))
+        {
+            bool decompressed = codebook.empty()
+                              ? huffman.Decompress(fin_map.Data(), fin_map.Size(), fout_map.Data(), fout_map.Size())
+                              : huffman.Decompress(fin_map.Data(), fin_map.Size(), fout_map.Data(), fout_map.Size(), codebook);
+
+            if(! decompressed)
+            {
+                Msg::DecompressFailed(std::cerr, fin_path);
+                retval = EINVAL;
+
+                /** No output is left of a failed decompression; the mapped one is already full size */
+                fout_map.Close();
+                unlink(fout_path.c_str());
+            }
 
-            retval = ENOENT;
             goto jump_exit;
         }
 
-        Huffman huffman;
+        fin_map.Close();
 
-        if(fout_path.empty())
-            huffman.Decompress(fin, std::cout);
+        std::ifstream fin_file;
+        if(! fin_path.empty())
+        {
+            fin_file.open(fin_path, std::ios::binary);
+            if(! fin_file.is_open())
+            {
+                Msg::CannotOpenFile(std::cerr, fin_path);
+                Msg::DecompressFailed(std::cerr, fin_path);
+
+                retval = ENOENT;
+                goto jump_exit;
+            }
+        }
+
+        /** Read standard input without a filename; it is only seeked for a range, and a pipe is decoded from its start then */
+        std::istream & fin = fin_path.empty() ? std::cin : fin_file;
+
+        std::ofstream fout_file;
+        if(! fout_path.empty())
+            fout_file.open(fout_path, std::ios::binary);
+
+        std::ostream & fout = fout_path.empty() ? std::cout : fout_file;
+
+        bool decompressed;
+
+        if(range)
+            decompressed = huffman.DecompressRange(fin, range_offset, range_length, fout);
+        else if(! codebook.empty())
+            decompressed = huffman.Decompress(fin, fout, codebook);
         else
+            decompressed = huffman.Decompress(fin, fout);
+
+        if(! decompressed || ! fout.flush().good())
         {
-            std::ofstream fout(fout_path, std::ios::binary);
-            huffman.Decompress(fin, fout);
-            fout.close();
+            Msg::DecompressFailed(std::cerr, fin_path.empty() ? "standard input" : fin_path);
+            retval = EINVAL;
         }
 
-        fin.close();
+        fout_file.close();
+        fin_file.close();
+
+        if(retval != 0 && ! fout_path.empty())
+            unlink(fout_path.c_str());
     }
 
 jump_exit:
+    /** Only once coding has begun */
+    if(stats_started)
+        Msg::Stats(std::cerr, stats, compress, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
     return retval;
 }
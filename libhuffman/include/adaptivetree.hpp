@@ -0,0 +1,275 @@
+#ifndef ALGORITHM_ADAPTIVETREE_H_
+#define ALGORITHM_ADAPTIVETREE_H_ 1
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace algorithm
+{
+
+/** \brief  Adaptive Huffman tree of the FGK algorithm
+
+    Encoder and decoder keep one each, and update them with every symbol,
+    so that no code table is sent. A symbol not seen yet is sent as the
+    codeword of the NYT (not yet transmitted) leaf, followed by the symbol.
+
+    Nodes are kept at numbered positions, in order of nondecreasing weight
+    with siblings side by side (the sibling property); the root is at the
+    highest position, and the NYT leaf at the lowest one in use.
+    Weights are halved, and the tree rebuilt, when the root reaches
+    weight_max; this bounds the codewords to codeword_len_max bits.
+*/
+class AdaptiveTree
+{
+public:
+    typedef size_t          SizeType;
+    typedef uint32_t        IndexType;
+    typedef uint32_t        WeightType;
+    typedef uint64_t        CodewordType;
+
+    static  const IndexType none            = ~IndexType(0);
+    static  const WeightType weight_max     = WeightType(1) << 18;
+    static  const SizeType  codeword_len_max = 32;     /**< Deepest leaf below a root of weight_max, with margin */
+
+private:
+    IndexType               root_;          /**< Position of the root; the highest one */
+    IndexType               nyt_;           /**< Position of the NYT leaf; the lowest one in use */
+
+    /** Each of the positions */
+    std::vector<WeightType> weight_;
+    std::vector<IndexType>  parent_;
+    std::vector<IndexType>  left_;          /**< Children of an internal node; none for a leaf */
+    std::vector<IndexType>  right_;
+    std::vector<IndexType>  symbol_;        /**< Symbol of a leaf; none for the NYT leaf, and inner nodes */
+
+    std::vector<IndexType>  leaf_;          /**< Position of the leaf of each symbol; none for a symbol not seen */
+
+    /** Exchange the subtrees at positions a and b, of the same weight */
+    void
+    Swap(const IndexType & a, const IndexType & b)
+    {
+        std::swap(left_[a],     left_[b]);
+        std::swap(right_[a],    right_[b]);
+        std::swap(symbol_[a],   symbol_[b]);
+
+        Adopt(a);
+        Adopt(b);
+    }
+
+    /** Point the children, or the symbol, of the node at `pos' back to it */
+    void
+    Adopt(const IndexType & pos)
+    {
+        if(left_[pos] != none)
+        {
+            parent_[left_[pos]]     = pos;
+            parent_[right_[pos]]    = pos;
+        }
+        else if(symbol_[pos] != none)
+            leaf_[symbol_[pos]] = pos;
+    }
+
+    /** Halve the weights, and rebuild a Huffman tree of them, numbered in the order of its merges */
+    void
+    Rescale(void)
+    {
+        struct Node
+        {
+            WeightType  weight;
+            IndexType   symbol;
+            IndexType   left;       /**< Nodes of the merge, or none for a leaf */
+            IndexType   right;
+        };
+
+        std::vector<Node> leaves;
+        leaves.push_back(Node{ 0, none, none, none });
+
+        for(IndexType pos = nyt_; pos <= root_; ++pos)
+            if(left_[pos] == none && symbol_[pos] != none)
+                leaves.push_back(Node{ (weight_[pos] + 1) / 2, symbol_[pos], none, none });
+
+        std::stable_sort(leaves.begin(), leaves.end(), [](const Node & lhs, const Node & rhs)
+        { return lhs.weight < rhs.weight; });
+
+        /** Two queues; leaves by weight, and merged nodes, which come out by weight too */
+        std::vector<Node>       nodes(leaves);
+        std::vector<IndexType>  order;              /**< Nodes in the order they leave the queues */
+        SizeType                next_leaf   = 0;
+        SizeType                next_merged = leaves.size();
+
+        auto take = [&](void)
+        {
+            bool leaf = next_leaf < leaves.size()
+                     && (next_merged == nodes.size() || nodes[next_leaf].weight <= nodes[next_merged].weight);
+
+            IndexType node = IndexType(leaf ? next_leaf++ : next_merged++);
+            order.push_back(node);
+
+            return node;
+        };
+
+        while((leaves.size() - next_leaf) + (nodes.size() - next_merged) > 1)
+        {
+            IndexType left  = take();
+            IndexType right = take();
+
+            nodes.push_back(Node{ nodes[left].weight + nodes[right].weight, none, left, right });
+        }
+
+        take();
+
+        /** The last node out is the root, at the highest position */
+        std::vector<IndexType> position(nodes.size());
+        for(SizeType i = 0; i < order.size(); ++i)
+            position[order[i]] = IndexType(root_ + 1 - order.size() + i);
+
+        std::fill(leaf_.begin(), leaf_.end(), IndexType(none));
+
+        for(SizeType i = 0; i < nodes.size(); ++i)
+        {
+            IndexType pos = position[i];
+
+            weight_[pos]    = nodes[i].weight;
+            symbol_[pos]    = nodes[i].symbol;
+            left_[pos]      = nodes[i].left  == none ? none : position[nodes[i].left];
+            right_[pos]     = nodes[i].right == none ? none : position[nodes[i].right];
+
+            Adopt(pos);
+        }
+
+        parent_[root_]  = none;
+        nyt_            = position[0];
+    }
+
+public:
+    AdaptiveTree(const SizeType & symbol_count)
+    : root_         (IndexType(2 * symbol_count))
+    , weight_       (2 * symbol_count + 1)
+    , parent_       (2 * symbol_count + 1)
+    , left_         (2 * symbol_count + 1)
+    , right_        (2 * symbol_count + 1)
+    , symbol_       (2 * symbol_count + 1)
+    , leaf_         (symbol_count)
+    {
+        Reset();
+    }
+
+    /** Back to a tree of the NYT leaf alone */
+    void
+    Reset(void)
+    {
+        nyt_ = root_;
+
+        weight_[root_]  = 0;
+        parent_[root_]  = none;
+        left_[root_]    = none;
+        right_[root_]   = none;
+        symbol_[root_]  = none;
+
+        std::fill(leaf_.begin(), leaf_.end(), IndexType(none));
+    }
+
+    /** Codeword of `symbol', or of the NYT leaf for none and a symbol not seen yet; returns its length */
+    SizeType
+    GetCodeword(const IndexType & symbol, CodewordType & codeword)
+    const
+    {
+        IndexType pos = (symbol == none || leaf_[symbol] == none) ? nyt_ : leaf_[symbol];
+
+        SizeType codeword_len = 0;
+        codeword = 0;
+
+        for(; pos != root_; pos = parent_[pos])
+            codeword |= CodewordType(right_[parent_[pos]] == pos) << codeword_len++;
+
+        return codeword_len;
+    }
+
+    bool
+    IsSeen(const IndexType & symbol)
+    const
+    { return leaf_[symbol] != none; }
+
+    /** Walking down for the decoder */
+    IndexType
+    Root(void)
+    const
+    { return root_; }
+
+    bool
+    IsLeaf(const IndexType & pos)
+    const
+    { return left_[pos] == none; }
+
+    IndexType
+    Child(const IndexType & pos, const bool & bit)
+    const
+    { return bit ? right_[pos] : left_[pos]; }
+
+    /** Symbol of the leaf at `pos'; none for the NYT leaf */
+    IndexType
+    Symbol(const IndexType & pos)
+    const
+    { return symbol_[pos]; }
+
+    /** Count one more of `symbol' */
+    void
+    Update(const IndexType & symbol)
+    {
+        IndexType pos = leaf_[symbol];
+
+        if(pos == none)
+        {
+            /** The NYT leaf gives birth to a new NYT leaf, and to the leaf of the symbol */
+            IndexType node = nyt_;
+
+            left_[node]     = node - 2;
+            right_[node]    = node - 1;
+            symbol_[node]   = none;
+
+            weight_[node - 1]   = 0;
+            parent_[node - 1]   = node;
+            left_[node - 1]     = none;
+            right_[node - 1]    = none;
+            symbol_[node - 1]   = symbol;
+            leaf_[symbol]       = node - 1;
+
+            weight_[node - 2]   = 0;
+            parent_[node - 2]   = node;
+            left_[node - 2]     = none;
+            right_[node - 2]    = none;
+            symbol_[node - 2]   = none;
+
+            nyt_ = node - 2;
+            pos  = node - 1;
+        }
+
+        for(; pos != none; pos = parent_[pos])
+        {
+            /** Move to the highest position of the same weight, unless it is the parent, then count;
+                mostly the node is the highest already, and the search is skipped
+            */
+            IndexType leader = pos;
+            if(pos != root_ && weight_[pos + 1] == weight_[pos])
+                leader = IndexType(std::upper_bound(weight_.begin() + pos, weight_.begin() + root_ + 1, weight_[pos])
+                                 - weight_.begin()) - 1;
+
+            if(leader != pos && leader != parent_[pos])
+            {
+                Swap(pos, leader);
+                pos = leader;
+            }
+
+            ++weight_[pos];
+        }
+
+        if(weight_[root_] >= weight_max)
+            Rescale();
+    }
+};
+
+} /** ns: algorithm */
+
+#endif /** ! ALGORITHM_ADAPTIVETREE_H_ */
@@ -1,5 +1,8 @@
 #ifndef ALGORITHM_BINARYSTREAM_H_
+#define ALGORITHM_BINARYSTREAM_H_ 1
 
+#include <cstddef>
+#include <cstdint>
 #include <istream>
 
 namespace algorithm
@@ -67,6 +70,59 @@ public:
         }
     }
 
+    /** Variable length integer; 7 bits per byte, least significant group first.
+        The top bit of each byte tells that more bytes follow.
+    */
+    template<
+        typename T          = uint64_t,
+        typename STREAM_OUT = std::ostream
+    >
+    static
+    void
+    WriteVarint(STREAM_OUT & fout, T src)
+    {
+        const   SizeType        buffer_size         = (sizeof(T) * 8 + 6) / 7;
+                unsigned char   buffer[buffer_size] = { 0, };
+                SizeType        len                 = 0;
+
+        do
+        {
+            buffer[len] = src & 0x7f;
+            src >>= 7;
+
+            if(src != 0)
+                buffer[len] |= 0x80;
+
+            ++len;
+        }
+        while(src != 0);
+
+        fout.write((char *)&buffer, sizeof(unsigned char) * len);
+    }
+
+    template<
+        typename T          = uint64_t,
+        typename STREAM_IN  = std::istream
+    >
+    static
+    void
+    ReadVarint(STREAM_IN & fin, T & dest)
+    {
+        dest = 0;
+
+        for(SizeType shift = 0; shift < sizeof(T) * 8; shift += 7)
+        {
+            unsigned char byte = 0;
+            if(! fin.read((char *)&byte, sizeof(unsigned char)))
+                return;
+
+            dest |= T(byte & 0x7f) << shift;
+
+            if((byte & 0x80) == 0)
+                return;
+        }
+    }
+
     template<
         typename T          = uint32_t,
         typename STREAM_OUT = std::ostream
@@ -0,0 +1,289 @@
+#ifndef ALGORITHM_BITSTREAM_H_
+#define ALGORITHM_BITSTREAM_H_ 1
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <istream>
+#include <vector>
+
+namespace algorithm
+{
+
+/** \brief  MSB-first bit reader over an input stream, or a range of memory
+
+    Keeps up to 64 bits of the bitstream in a reservoir, aligned to the most
+    significant bit, so that a decoder can peek a whole codeword at once.
+    A stream is pulled in large chunks instead of one byte per call; Require
+    pulls only what the stream has at hand, so that a live stream is decoded
+    as far as its bytes go. Past the end of the input the reservoir is padded
+    with zero bits.
+*/
+class BitReader
+{
+public:
+    typedef size_t          SizeType;
+    typedef uint8_t         ByteType;
+    typedef uint64_t        ReservoirType;
+
+    static  const SizeType  byte_size       = 8;
+    static  const SizeType  reservoir_size  = sizeof(ReservoirType) * byte_size;
+    static  const SizeType  chunk_size      = 1 << 16;
+
+private:
+    std::istream *          fin_;           /**< nullptr when reading from memory */
+    std::vector<ByteType>   buffer_;        /**< Chunk of fin_ */
+    const ByteType *        data_;          /**< Bytes being read; buffer_, or the range of memory */
+    SizeType                pos_;           /**< Next unread byte in data_ */
+    SizeType                end_;           /**< End of the valid bytes in data_ */
+    ReservoirType           reservoir_;
+    SizeType                bitcount_;      /**< Valid bits in reservoir_ */
+    SizeType                padding_;       /**< Zero bytes appended past the end of input */
+
+    /** Read a chunk of fin_; with `at_hand', wait for one byte at least, and take no more than is buffered for it */
+    void
+    Fill(const bool & at_hand)
+    {
+        if(fin_ == nullptr || ! fin_->good())
+            return;
+
+        /** Keep the unread tail, so that a word can be loaded at once */
+        SizeType remain = end_ - pos_;
+        for(SizeType i = 0; i < remain; ++i)
+            buffer_[i] = buffer_[pos_ + i];
+
+        pos_ = 0;
+        end_ = remain;
+
+        std::streamsize want = std::streamsize(buffer_.size() - end_);
+
+        if(at_hand)
+        {
+            std::streambuf * buf = fin_->rdbuf();
+            if(std::istream::traits_type::eq_int_type(buf->sgetc(), std::istream::traits_type::eof()))
+            {
+                fin_->setstate(std::ios_base::eofbit);
+                return;
+            }
+
+            /** A buffer that cannot tell what it holds is read one byte at a time */
+            want = std::min(want, std::max(buf->in_avail(), std::streamsize(1)));
+        }
+
+        fin_->read((char *)&buffer_[end_], want);
+        end_ += SizeType(fin_->gcount());
+    }
+
+public:
+    BitReader(std::istream & fin)
+    : fin_          (&fin)
+    , buffer_       (chunk_size)
+    , data_         (&buffer_[0])
+    , pos_          (0)
+    , end_          (0)
+    , reservoir_    (0)
+    , bitcount_     (0)
+    , padding_      (0)
+    { }
+
+    BitReader(const ByteType * data, const SizeType & size)
+    : fin_          (nullptr)
+    , data_         (data)
+    , pos_          (0)
+    , end_          (size)
+    , reservoir_    (0)
+    , bitcount_     (0)
+    , padding_      (0)
+    { }
+
+    /** Top up the reservoir to at least 57 bits */
+    inline
+    void
+    Refill(void)
+    {
+        if(end_ - pos_ < sizeof(ReservoirType))
+            Fill(false);
+
+        if(end_ - pos_ >= sizeof(ReservoirType))
+        {
+            ReservoirType word;
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            std::memcpy(&word, data_ + pos_, sizeof(ReservoirType));
+            word = __builtin_bswap64(word);
+#else
+            word = 0;
+            for(SizeType i = 0; i < sizeof(ReservoirType); ++i)
+                word = (word << byte_size) | data_[pos_ + i];
+#endif
+
+            reservoir_ |= word >> bitcount_;
+            pos_       += (reservoir_size - 1 - bitcount_) / byte_size;
+            bitcount_  |= reservoir_size - byte_size;
+        }
+        else
+        {
+            while(bitcount_ <= reservoir_size - byte_size)
+            {
+                if(pos_ < end_)
+                    reservoir_ |= ReservoirType(data_[pos_++]) << (reservoir_size - byte_size - bitcount_);
+                else
+                    ++padding_;
+
+                bitcount_ += byte_size;
+            }
+        }
+    }
+
+    /** Top up the reservoir to at least `n' bits, 0 < n <= 57, reading no further into a stream than that */
+    inline
+    void
+    Require(const SizeType & n)
+    {
+        if(bitcount_ >= n)
+            return;
+
+        /** A whole word at hand is loaded at once, as by Refill */
+        if(end_ - pos_ >= sizeof(ReservoirType))
+        {
+            Refill();
+            return;
+        }
+
+        while(bitcount_ < n)
+        {
+            if(pos_ == end_)
+                Fill(true);
+
+            if(pos_ < end_)
+                reservoir_ |= ReservoirType(data_[pos_++]) << (reservoir_size - byte_size - bitcount_);
+            else
+                ++padding_;
+
+            bitcount_ += byte_size;
+        }
+    }
+
+    /** Next `n' bits of the input, 0 < n < 64 */
+    inline
+    ReservoirType
+    Peek(const SizeType & n)
+    const
+    { return reservoir_ >> (reservoir_size - n); }
+
+    inline
+    void
+    Skip(const SizeType & n)
+    {
+        reservoir_ <<= n;
+        bitcount_   -= n;
+    }
+
+    /** Bits consumed beyond the end of the input */
+    inline
+    SizeType
+    Overrun(void)
+    const
+    {
+        SizeType padding_bits = padding_ * byte_size;
+        return (padding_bits > bitcount_) ? padding_bits - bitcount_ : 0;
+    }
+
+    /** Skip to the next whole byte of the input; the reservoir always ends on one */
+    inline
+    void
+    Align(void)
+    { Skip(bitcount_ % byte_size); }
+};
+
+/** \brief  MSB-first bit writer into memory of a known size
+
+    Codes are appended to a 64-bit accumulator, aligned to the most
+    significant bit. Each Put stores the whole accumulator, big-endian,
+    and moves on by the bytes it completed, so that no branch depends on
+    the codes. The last partial byte is stored padded with zero bits, and
+    the output has to be `slack' bytes longer than the bits put.
+*/
+class BitWriter
+{
+public:
+    typedef size_t          SizeType;
+    typedef uint8_t         ByteType;
+    typedef uint64_t        AccumulatorType;
+
+    static  const SizeType  byte_size   = 8;
+    static  const SizeType  put_max     = 32;                               /**< Most bits of one Put */
+    static  const SizeType  slack       = sizeof(AccumulatorType);          /**< Bytes stored past the last bit */
+
+private:
+    ByteType *              out_;           /**< Byte holding the first pending bit */
+    AccumulatorType         accumulator_;   /**< Pending bits, from the most significant one */
+    SizeType                bitcount_;      /**< Pending bits, fewer than byte_size between calls */
+
+public:
+    BitWriter(ByteType * out = nullptr)
+    : out_          (out)
+    , accumulator_  (0)
+    , bitcount_     (0)
+    { }
+
+    /** Append the low `n' bits of `bits', 0 <= n <= put_max; the bits above them are zero */
+    inline
+    void
+    Put(const AccumulatorType & bits, const SizeType & n)
+    {
+        /** Two shifts, as a shift by 64 is undefined for n = 0 */
+        accumulator_   |= (bits << (sizeof(AccumulatorType) * byte_size - 1 - bitcount_ - n)) << 1;
+        bitcount_      += n;
+
+        AccumulatorType word = accumulator_;
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        word = __builtin_bswap64(word);
+#else
+        ByteType * bytes = (ByteType *)&word;
+        for(SizeType i = 0; i < sizeof(AccumulatorType); ++i)
+            bytes[i] = ByteType(accumulator_ >> (sizeof(AccumulatorType) * byte_size - byte_size - i * byte_size));
+#endif
+        std::memcpy(out_, &word, sizeof(AccumulatorType));
+
+        SizeType bytes  = bitcount_ / byte_size;
+
+        out_           += bytes;
+        accumulator_  <<= bytes * byte_size;
+        bitcount_      -= bytes * byte_size;
+    }
+
+    /** Pad the pending bits with zero bits, up to a whole byte */
+    inline
+    void
+    Align(void)
+    {
+        Put(0, 0);
+
+        out_           += (bitcount_ + byte_size - 1) / byte_size;
+        accumulator_    = 0;
+        bitcount_       = 0;
+    }
+
+    /** Hand over the whole bytes written from `start'; returns how many there are.
+        The writer goes on from `start' again, so that a small output can be reused.
+    */
+    SizeType
+    Drain(ByteType * start)
+    {
+        SizeType done = SizeType(out_ - start);
+        out_ = start;
+
+        return done;
+    }
+
+    /** Bytes in use from `start', the first byte of the output, up to the last bit put */
+    SizeType
+    Size(const ByteType * start)
+    const
+    { return SizeType(out_ - start) + (bitcount_ + byte_size - 1) / byte_size; }
+};
+
+} /** ns: algorithm */
+
+#endif /** ! ALGORITHM_BITSTREAM_H_ */
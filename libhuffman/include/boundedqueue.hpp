@@ -0,0 +1,96 @@
+#ifndef ALGORITHM_BOUNDEDQUEUE_H_
+#define ALGORITHM_BOUNDEDQUEUE_H_ 1
+
+#include <cstddef>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+namespace algorithm
+{
+
+/** \brief  Queue of a fixed capacity, between the stages of a pipeline
+
+    Push waits while the queue is full, and Pop while it is empty, so that
+    a stage running ahead is held back by the one after it. Close ends the
+    queue; Pop returns false once the items left in it are taken, and Push
+    drops its item.
+*/
+template<typename T>
+class BoundedQueue
+{
+public:
+    typedef size_t          SizeType;
+    typedef T               ValueType;
+
+private:
+    std::deque<ValueType>   items_;
+    SizeType                capacity_;
+    std::mutex              mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+    bool                    closed_;
+
+public:
+    explicit
+    BoundedQueue(const SizeType & capacity)
+    : capacity_     (capacity)
+    , closed_       (false)
+    {}
+
+    BoundedQueue(const BoundedQueue &) = delete;
+    BoundedQueue & operator=(const BoundedQueue &) = delete;
+
+    /** False when the queue is closed */
+    bool
+    Push(const ValueType & item)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            not_full_.wait(lock, [this] { return closed_ || items_.size() < capacity_; });
+
+            if(closed_)
+                return false;
+
+            items_.push_back(item);
+        }
+
+        not_empty_.notify_one();
+        return true;
+    }
+
+    /** False when the queue is closed, and empty */
+    bool
+    Pop(ValueType & item)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            not_empty_.wait(lock, [this] { return closed_ || ! items_.empty(); });
+
+            if(items_.empty())
+                return false;
+
+            item = items_.front();
+            items_.pop_front();
+        }
+
+        not_full_.notify_one();
+        return true;
+    }
+
+    void
+    Close(void)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+        }
+
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+};
+
+} /** ns: algorithm */
+
+#endif /** ! ALGORITHM_BOUNDEDQUEUE_H_ */
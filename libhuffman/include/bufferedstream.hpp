@@ -0,0 +1,477 @@
+#ifndef ALGORITHM_BUFFEREDSTREAM_H_
+#define ALGORITHM_BUFFEREDSTREAM_H_ 1
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <streambuf>
+#include <vector>
+
+namespace algorithm
+{
+
+/** \brief  Byte reader over an input stream, or a range of memory
+
+    A stream is pulled in large chunks, so that the small reads of the
+    headers are served from memory. It has the read() of a std::istream,
+    and can be given to BinaryStream::Read and BinaryStream::ReadVarint;
+    the byte order is the one of BinaryStream.
+*/
+class BufferedReader
+{
+public:
+    typedef size_t          SizeType;
+    typedef uint8_t         ByteType;
+
+    static  const SizeType  chunk_size  = 1 << 16;
+
+private:
+    std::istream *          fin_;           /**< nullptr when reading from memory */
+    std::vector<ByteType>   buffer_;        /**< Chunk of fin_ */
+    const ByteType *        data_;          /**< Bytes being read; buffer_, or the range of memory */
+    SizeType                pos_;           /**< Next unread byte in data_ */
+    SizeType                end_;           /**< End of the valid bytes in data_ */
+    SizeType                consumed_;      /**< Bytes read before data_ */
+    SizeType                gcount_;        /**< Bytes copied by the last read() */
+    bool                    good_;
+
+    void
+    Fill(void)
+    {
+        consumed_   += end_;
+        pos_        = 0;
+        end_        = 0;
+
+        if(fin_ == nullptr || ! fin_->good())
+            return;
+
+        fin_->read((char *)buffer_.data(), std::streamsize(buffer_.size()));
+        end_ = SizeType(fin_->gcount());
+    }
+
+public:
+    BufferedReader(std::istream & fin, const SizeType & capacity = chunk_size)
+    : fin_          (&fin)
+    , buffer_       (capacity)
+    , data_         (buffer_.data())
+    , pos_          (0)
+    , end_          (0)
+    , consumed_     (0)
+    , gcount_       (0)
+    , good_         (true)
+    {}
+
+    BufferedReader(const ByteType * data, const SizeType & size)
+    : fin_          (nullptr)
+    , data_         (data)
+    , pos_          (0)
+    , end_          (size)
+    , consumed_     (0)
+    , gcount_       (0)
+    , good_         (true)
+    {}
+
+    BufferedReader &
+    read(char * dest, const std::streamsize & len)
+    {
+        SizeType want = SizeType(len);
+        gcount_ = 0;
+
+        while(want > 0)
+        {
+            if(pos_ == end_)
+            {
+                /** A long read goes past the chunk, straight into dest */
+                if(fin_ != nullptr && want >= buffer_.size() && fin_->good())
+                {
+                    consumed_ += end_;
+                    pos_ = end_ = 0;
+
+                    fin_->read(dest + gcount_, std::streamsize(want));
+                    SizeType got = SizeType(fin_->gcount());
+
+                    consumed_   += got;
+                    gcount_     += got;
+                    want        -= got;
+                    break;
+                }
+
+                Fill();
+                if(pos_ == end_)
+                    break;
+            }
+
+            SizeType len_copy = std::min(want, end_ - pos_);
+            std::memcpy(dest + gcount_, data_ + pos_, len_copy);
+
+            pos_    += len_copy;
+            gcount_ += len_copy;
+            want    -= len_copy;
+        }
+
+        if(want > 0)
+            good_ = false;
+
+        return *this;
+    }
+
+    std::streamsize
+    gcount(void)
+    const
+    { return std::streamsize(gcount_); }
+
+    bool
+    good(void)
+    const
+    { return good_; }
+
+    explicit
+    operator bool(void)
+    const
+    { return good_; }
+
+    /** Bytes consumed from the start of the input */
+    SizeType
+    Position(void)
+    const
+    { return consumed_ + pos_; }
+};
+
+/** \brief  Byte writer into a growing buffer, optionally pushed to an output stream
+
+    Small writes are appended to memory, and reach the stream in large chunks.
+    Reserve() hands out raw bytes, for a hot loop to store into directly.
+    Over memory of a known size the bytes are written in place; the ones that
+    do not fit are held apart, and Flush() moves them in once they do.
+    It has the write() of a std::ostream, and can be given to BinaryStream::Write
+    and BinaryStream::WriteVarint; the byte order is the one of BinaryStream.
+*/
+class BufferedWriter
+{
+public:
+    typedef size_t          SizeType;
+    typedef uint8_t         ByteType;
+
+    static  const SizeType  chunk_size  = 1 << 16;
+
+private:
+    std::ostream *          fout_;          /**< nullptr when writing to memory only */
+    std::vector<ByteType>   buffer_;        /**< Bytes pending; over range_, the ones past spill_ */
+    SizeType                capacity_;      /**< Bytes pending before they are pushed to fout_ */
+    bool                    in_place_;      /**< Whether range_ is written in place, rather than buffer_ */
+    ByteType *              range_;
+    SizeType                range_size_;
+    SizeType                size_;          /**< Bytes written into range_, buffer_ included */
+    SizeType                spill_;         /**< Position of the first byte of buffer_, once range_ was too small */
+    std::vector<ByteType> * lender_;        /**< Owner of the memory of buffer_, given back to it by the destructor */
+
+    /** The buffer grows by doubling, from empty too; so that a writer reused for blocks of about one size stops allocating */
+    void
+    Grow(const SizeType & size)
+    {
+        if(size > buffer_.capacity())
+            buffer_.reserve(std::max(size, 2 * buffer_.capacity()));
+    }
+
+public:
+    /** Keeps every byte in memory; they are taken with Data() and Size() */
+    BufferedWriter(void)
+    : fout_         (nullptr)
+    , capacity_     (0)
+    , in_place_     (false)
+    , range_        (nullptr)
+    , range_size_   (0)
+    , size_         (0)
+    , spill_        (0)
+    , lender_       (nullptr)
+    {}
+
+    BufferedWriter(std::ostream & fout, const SizeType & capacity = chunk_size)
+    : fout_         (&fout)
+    , capacity_     (capacity)
+    , in_place_     (false)
+    , range_        (nullptr)
+    , range_size_   (0)
+    , size_         (0)
+    , spill_        (0)
+    , lender_       (nullptr)
+    { buffer_.reserve(capacity_); }
+
+    /** Buffers in the memory of `buffer', which gets it back, emptied, when the writer is gone;
+        so that a writer for each stream allocates only the first time
+    */
+    BufferedWriter(std::ostream & fout, std::vector<ByteType> & buffer, const SizeType & capacity = chunk_size)
+    : fout_         (&fout)
+    , capacity_     (capacity)
+    , in_place_     (false)
+    , range_        (nullptr)
+    , range_size_   (0)
+    , size_         (0)
+    , spill_        (0)
+    , lender_       (&buffer)
+    {
+        buffer_.swap(buffer);
+        buffer_.clear();
+        buffer_.reserve(capacity_);
+    }
+
+    /** Writes into the `size' bytes of `data' in place; good() fails once more than that is written */
+    BufferedWriter(ByteType * data, const SizeType & size)
+    : fout_         (nullptr)
+    , capacity_     (0)
+    , in_place_     (true)
+    , range_        (data)
+    , range_size_   (size)
+    , size_         (0)
+    , spill_        (0)
+    , lender_       (nullptr)
+    {}
+
+    /** A stream that throws on failure is left with its state set, as the writer may be destroyed by an exception */
+    ~BufferedWriter(void)
+    {
+        try
+        {
+            Flush();
+        }
+        catch(...)
+        {
+        }
+
+        if(lender_ != nullptr)
+        {
+            buffer_.clear();
+            buffer_.swap(*lender_);
+        }
+    }
+
+    BufferedWriter &
+    write(const char * src, const std::streamsize & len)
+    {
+        /** A write of a whole chunk goes to the stream as it is */
+        if(fout_ != nullptr && SizeType(len) >= capacity_)
+        {
+            Flush();
+            fout_->write(src, len);
+            return *this;
+        }
+
+        std::memcpy(Reserve(SizeType(len)), src, SizeType(len));
+        return *this;
+    }
+
+    /** Append `len' bytes, to be filled in by the caller before the next call */
+    ByteType *
+    Reserve(const SizeType & len)
+    {
+        if(in_place_)
+        {
+            SizeType pos = size_;
+            size_ += len;
+
+            if(buffer_.empty() && size_ <= range_size_)
+                return range_ + pos;
+
+            if(buffer_.empty())
+                spill_ = pos;
+
+            Grow(size_ - spill_);
+            buffer_.resize(size_ - spill_);
+            return buffer_.data() + (pos - spill_);
+        }
+
+        if(fout_ != nullptr && buffer_.size() + len > capacity_)
+            Flush();
+
+        SizeType pos = buffer_.size();
+        Grow(pos + len);
+        buffer_.resize(pos + len);
+
+        return buffer_.data() + pos;
+    }
+
+    /** Give back the last `len' bytes of the last Reserve() */
+    void
+    Unreserve(const SizeType & len)
+    {
+        if(in_place_)
+        {
+            size_ -= len;
+
+            if(! buffer_.empty())
+                buffer_.resize(size_ > spill_ ? size_ - spill_ : 0);
+
+            return;
+        }
+
+        buffer_.resize(buffer_.size() - len);
+    }
+
+    void
+    Flush(void)
+    {
+        if(in_place_)
+        {
+            /** Bytes held apart are moved in, once they fit */
+            if(! buffer_.empty() && size_ <= range_size_)
+            {
+                std::memcpy(range_ + spill_, buffer_.data(), buffer_.size());
+                buffer_.clear();
+            }
+
+            return;
+        }
+
+        if(fout_ == nullptr || buffer_.empty())
+            return;
+
+        fout_->write((char *)buffer_.data(), std::streamsize(buffer_.size()));
+        buffer_.clear();
+    }
+
+    /** Drop the bytes kept in memory; the capacity stays, for the next use */
+    void
+    Clear(void)
+    {
+        buffer_.clear();
+        size_ = 0;
+    }
+
+    /** Whether the bytes are written in place, where the caller wants them, and Size() counts all of them */
+    bool
+    InPlace(void)
+    const
+    { return in_place_; }
+
+    /** Over memory of a known size, the bytes are there after Flush() */
+    const ByteType *
+    Data(void)
+    const
+    { return in_place_ ? range_ : buffer_.data(); }
+
+    SizeType
+    Size(void)
+    const
+    { return in_place_ ? size_ : buffer_.size(); }
+
+    bool
+    good(void)
+    const
+    {
+        if(in_place_)
+            return size_ <= range_size_;
+
+        return fout_ == nullptr || fout_->good();
+    }
+};
+
+/** \brief  Stream buffer over a fixed range of memory
+
+    Lets the stream based parsers read bytes that are already in memory,
+    seeking included, and write into memory of a known size; writing
+    past the end of the range fails the stream.
+*/
+class MemoryStreamBuffer : public std::streambuf
+{
+public:
+    typedef size_t          SizeType;
+
+    MemoryStreamBuffer(const void * data, const SizeType & size)
+    {
+        char * begin = (char *)data;
+        setg(begin, begin, begin + size);
+    }
+
+    MemoryStreamBuffer(void * data, const SizeType & size)
+    {
+        char * begin = (char *)data;
+        setg(begin, begin, begin + size);
+        setp(begin, begin + size);
+    }
+
+    /** Bytes consumed from the start of the range */
+    SizeType
+    Position(void)
+    const
+    { return SizeType(gptr() - eback()); }
+
+    /** Bytes written from the start of the range */
+    SizeType
+    Written(void)
+    const
+    { return SizeType(pptr() - pbase()); }
+
+protected:
+    pos_type
+    seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which = std::ios_base::in)
+    {
+        char * base = (dir == std::ios_base::beg) ? eback()
+                    : (dir == std::ios_base::cur) ? gptr()
+                    :                               egptr();
+
+        /** The offset is checked before it moves a pointer; a damaged one may point anywhere */
+        if(! (which & std::ios_base::in) || off < off_type(eback() - base) || off > off_type(egptr() - base))
+            return pos_type(off_type(-1));
+
+        setg(eback(), base + off, egptr());
+        return pos_type(off_type(gptr() - eback()));
+    }
+
+    pos_type
+    seekpos(pos_type pos, std::ios_base::openmode which = std::ios_base::in)
+    { return seekoff(off_type(pos), std::ios_base::beg, which); }
+};
+
+/** \brief  Stream buffer passing a range of the bytes written to it to another stream
+
+    Drops the first `offset' bytes, passes the next `length' to fout, and
+    drops the rest; a stream that cannot be seeked is cut to a range by it.
+*/
+class RangeStreamBuffer : public std::streambuf
+{
+public:
+    typedef size_t          SizeType;
+
+private:
+    std::ostream *          fout_;
+    SizeType                skip_;          /**< Bytes yet to drop before the range */
+    SizeType                left_;          /**< Bytes of the range yet to pass */
+
+public:
+    RangeStreamBuffer(std::ostream & fout, const SizeType & offset, const SizeType & length)
+    : fout_         (&fout)
+    , skip_         (offset)
+    , left_         (length)
+    {}
+
+protected:
+    int_type
+    overflow(int_type ch)
+    {
+        if(traits_type::eq_int_type(ch, traits_type::eof()))
+            return traits_type::not_eof(ch);
+
+        char byte = traits_type::to_char_type(ch);
+        return xsputn(&byte, 1) == 1 ? ch : traits_type::eof();
+    }
+
+    std::streamsize
+    xsputn(const char * data, std::streamsize len)
+    {
+        SizeType dropped    = std::min(SizeType(len), skip_);
+        SizeType passed     = std::min(SizeType(len) - dropped, left_);
+
+        skip_ -= dropped;
+        left_ -= passed;
+
+        fout_->write(data + dropped, std::streamsize(passed));
+        return fout_->good() ? len : 0;
+    }
+};
+
+} /** ns: algorithm */
+
+#endif /** ! ALGORITHM_BUFFEREDSTREAM_H_ */
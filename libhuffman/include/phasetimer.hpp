@@ -0,0 +1,40 @@
+#ifndef ALGORITHM_PHASETIMER_H_
+#define ALGORITHM_PHASETIMER_H_ 1
+
+#include <chrono>
+
+namespace algorithm
+{
+
+/** \brief  Adds the wall-clock time of its scope to a phase of the stats
+
+    The phase is a member of type double of the stats, in seconds.
+    Without stats no clock is read.
+*/
+class PhaseTimer
+{
+private:
+    typedef std::chrono::steady_clock   ClockType;
+
+    double *                time_;
+    ClockType::time_point   start_;
+
+public:
+    template<typename STATS>
+    PhaseTimer(STATS * stats, double STATS::* phase)
+    : time_     (stats != nullptr ? &(stats->*phase) : nullptr)
+    {
+        if(time_ != nullptr)
+            start_ = ClockType::now();
+    }
+
+    ~PhaseTimer(void)
+    {
+        if(time_ != nullptr)
+            *time_ += std::chrono::duration<double>(ClockType::now() - start_).count();
+    }
+};
+
+} /** ns: algorithm */
+
+#endif /** ! ALGORITHM_PHASETIMER_H_ */
@@ -0,0 +1,123 @@
+#ifndef ALGORITHM_RUNSCANNER_H_
+#define ALGORITHM_RUNSCANNER_H_ 1
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace algorithm
+{
+
+/** \brief  Scanner of the runs of equal bytes
+
+    Finds where a run ends by comparing each byte with the next one,
+    a whole window of bytes at a time: 32 with AVX2, 2 x 16 with SSE2,
+    and one by one elsewhere. A long run costs one compare per window,
+    and a window of short runs is walked with a count of trailing zeros.
+*/
+class RunScanner
+{
+public:
+    typedef size_t          SizeType;
+    typedef uint8_t         ByteType;
+    typedef uint32_t        MaskType;
+
+    static  const SizeType  window_size = sizeof(MaskType) * 8;
+
+    /** Bit i is set when p[i] differs from p[i + 1]; reads p[0] to p[window_size] */
+    static
+    inline
+    MaskType
+    BoundaryMask(const ByteType * p)
+    {
+#if defined(__AVX2__)
+        __m256i a = _mm256_loadu_si256((const __m256i *)p);
+        __m256i b = _mm256_loadu_si256((const __m256i *)(p + 1));
+
+        return ~MaskType(_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)));
+#elif defined(__SSE2__)
+        __m128i a_low   = _mm_loadu_si128((const __m128i *)p);
+        __m128i b_low   = _mm_loadu_si128((const __m128i *)(p + 1));
+        __m128i a_high  = _mm_loadu_si128((const __m128i *)(p + 16));
+        __m128i b_high  = _mm_loadu_si128((const __m128i *)(p + 17));
+
+        MaskType low    = MaskType(_mm_movemask_epi8(_mm_cmpeq_epi8(a_low, b_low)));
+        MaskType high   = MaskType(_mm_movemask_epi8(_mm_cmpeq_epi8(a_high, b_high)));
+
+        return ~(low | (high << 16));
+#else
+        MaskType mask = 0;
+
+        for(SizeType i = 0; i < window_size; ++i)
+            mask |= MaskType(p[i] != p[i + 1]) << i;
+
+        return mask;
+#endif
+    }
+
+    /** Index of the lowest set bit; mask is not zero */
+    static
+    inline
+    SizeType
+    LowestBit(const MaskType & mask)
+    {
+#if defined(__GNUC__)
+        return SizeType(__builtin_ctz(mask));
+#else
+        SizeType bit = 0;
+        for(; (mask >> bit & 0x1) == 0; ++bit);
+        return bit;
+#endif
+    }
+
+    /** Call func(symbol, run_len) for each run of data, in order.
+        Stops early when func returns false; returns false then.
+    */
+    template<typename FUNC>
+    static
+    bool
+    Scan(const ByteType * data, const SizeType & len, FUNC func)
+    {
+        if(len == 0)
+            return true;
+
+        SizeType run_start  = 0;
+        SizeType pos        = 0;
+
+        /** A window reads one byte past its end */
+        for(; pos + window_size < len; pos += window_size)
+        {
+            for(MaskType mask = BoundaryMask(data + pos); mask != 0; mask &= mask - 1)
+            {
+                SizeType run_end = pos + LowestBit(mask) + 1;
+
+                if(! func(data[run_start], run_end - run_start))
+                    return false;
+
+                run_start = run_end;
+            }
+        }
+
+        for(; pos + 1 < len; ++pos)
+        {
+            if(data[pos] != data[pos + 1])
+            {
+                if(! func(data[run_start], pos + 1 - run_start))
+                    return false;
+
+                run_start = pos + 1;
+            }
+        }
+
+        return func(data[run_start], len - run_start);
+    }
+};
+
+} /** ns: algorithm */
+
+#endif /** ! ALGORITHM_RUNSCANNER_H_ */
@@ -0,0 +1,72 @@
+#ifndef ALGORITHM_STAGETHREAD_H_
+#define ALGORITHM_STAGETHREAD_H_ 1
+
+#include <exception>
+#include <functional>
+#include <thread>
+
+namespace algorithm
+{
+
+/** \brief  Thread of a stage of a pipeline, joined on every way out of its scope
+
+    `close' ends the queues the stage waits on. It is called when the stage
+    throws, so that the other stages are not left waiting on it, and before
+    the stage is joined by the destructor, so that an exception thrown by
+    the caller neither blocks on the stage, nor destroys it joinable.
+    What the stage threw is thrown again by Join.
+*/
+class StageThread
+{
+public:
+    typedef std::function<void(void)>   CloseType;
+
+private:
+    CloseType           close_;
+    std::exception_ptr  failure_;
+    std::thread         thread_;
+
+public:
+    template<typename FUNC>
+    StageThread(FUNC func, const CloseType & close)
+    : close_    (close)
+    , thread_   ([this, func]
+    {
+        try
+        {
+            func();
+        }
+        catch(...)
+        {
+            failure_ = std::current_exception();
+            close_();
+        }
+    })
+    {}
+
+    ~StageThread(void)
+    {
+        if(thread_.joinable())
+        {
+            close_();
+            thread_.join();
+        }
+    }
+
+    StageThread(const StageThread &) = delete;
+    StageThread & operator=(const StageThread &) = delete;
+
+    /** Wait for the stage to end, and throw what it threw */
+    void
+    Join(void)
+    {
+        thread_.join();
+
+        if(failure_)
+            std::rethrow_exception(failure_);
+    }
+};
+
+} /** ns: algorithm */
+
+#endif /** ! ALGORITHM_STAGETHREAD_H_ */
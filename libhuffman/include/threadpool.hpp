@@ -0,0 +1,116 @@
+#ifndef ALGORITHM_THREADPOOL_H_
+#define ALGORITHM_THREADPOOL_H_ 1
+
+#include <cstddef>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace algorithm
+{
+
+/** \brief  Fixed-size pool of worker threads
+
+    Tasks are run in the order they are submitted, by whichever worker is
+    free. The result of a task is delivered through the returned future.
+    A pool without workers runs each task on the calling thread, in Submit.
+*/
+class ThreadPool
+{
+public:
+    typedef size_t                      SizeType;
+    typedef std::function<void(void)>   TaskType;
+
+private:
+    std::vector<std::thread>    workers_;
+    std::queue<TaskType>        tasks_;
+    std::mutex                  mutex_;
+    std::condition_variable     ready_;
+    bool                        stop_;
+
+    void
+    Work(void)
+    {
+        while(true)
+        {
+            TaskType task;
+
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                ready_.wait(lock, [this] { return stop_ || ! tasks_.empty(); });
+
+                if(tasks_.empty())
+                    return;
+
+                task = std::move(tasks_.front());
+                tasks_.pop();
+            }
+
+            task();
+        }
+    }
+
+public:
+    explicit
+    ThreadPool(const SizeType & thread_count)
+    : stop_(false)
+    {
+        for(SizeType i = 0; i < thread_count; ++i)
+            workers_.emplace_back(&ThreadPool::Work, this);
+    }
+
+    /** Runs the remaining tasks, then joins the workers */
+    ~ThreadPool(void)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+
+        ready_.notify_all();
+
+        for(auto & worker : workers_)
+            worker.join();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool & operator=(const ThreadPool &) = delete;
+
+    template<typename FUNC>
+    std::future<typename std::result_of<FUNC()>::type>
+    Submit(FUNC func)
+    {
+        typedef typename std::result_of<FUNC()>::type ResultType;
+
+        auto task = std::make_shared<std::packaged_task<ResultType(void)> >(func);
+        std::future<ResultType> result = task->get_future();
+
+        if(workers_.empty())
+        {
+            (*task)();
+            return result;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tasks_.push([task] { (*task)(); });
+        }
+
+        ready_.notify_one();
+        return result;
+    }
+
+    SizeType
+    size(void)
+    const
+    { return workers_.size(); }
+};
+
+} /** ns: algorithm */
+
+#endif /** ! ALGORITHM_THREADPOOL_H_ */
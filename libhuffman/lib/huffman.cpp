@@ -1,350 +1,3898 @@
 #include "huffman.hpp"
 
 #include <fstream>
+#include <deque>
+#include <memory>
 #include <map>
+#include <unordered_map>
+#include <tuple>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
 
 #include "heap.hpp"
 #include "binarystream.hpp"
+#include "bitstream.hpp"
+#include "threadpool.hpp"
+#include "runscanner.hpp"
+#include "bufferedstream.hpp"
+#include "adaptivetree.hpp"
+#include "boundedqueue.hpp"
+#include "stagethread.hpp"
+#include "phasetimer.hpp"
 
 using namespace algorithm;
 
-void
-Huffman
-::Compress(StreamInType & fin, StreamOutType & fout)
+namespace
 {
-    CollectRuns(fin);
 
-    fin.clear();            /** Remove eofbit */
-    WriteHeader(fin, fout);
+/** Resolves the next codeword of the reader through the decode tables */
+inline
+const Huffman::DecodeEntryType &
+ReadCodeword(const Huffman::DecodeTableType & table, BitReader & reader)
+{
+    reader.Refill();
 
-    CreateHuffmanTree();
-    AssignCodeword(root_, 0, 0);
+    const Huffman::DecodeEntryType * entry = &table[reader.Peek(Huffman::lookup_bits)];
+    while(entry->sub_bits != 0)
+    {
+        reader.Skip(entry->bits);
+        entry = &table[entry->value + reader.Peek(entry->sub_bits)];
+    }
+    reader.Skip(entry->bits);
 
-    CreateRunList(root_);
-    Encode(fin, fout);
+    return *entry;
 }
 
-void
-Huffman
-::Decompress(StreamInType & fin, StreamOutType & fout)
+/** Length codes of the bucketed blocks, in the style of DEFLATE;
+    codes 1 to 8 are run lengths of their own, and after them each power of two
+    is split into 4 codes, with the offset from their base length in extra bits
+*/
+inline
+Huffman::SizeType
+LengthCode(const Huffman::SizeType & run_len)
 {
-    SizeType fout_size = ReadHeader(fin);
+    if(run_len <= 8)
+        return run_len;
 
-    CreateHuffmanTree();
-    AssignCodeword(root_, 0, 0);
+    Huffman::SizeType n     = run_len - 1;
+    Huffman::SizeType extra = 1;
+
+    while((n >> (extra + 3)) != 0)
+        ++extra;
 
-    Decode(fin, fout, fout_size);
+    return 8 + 4 * (extra - 1) + ((n >> extra) & 0x3) + 1;
 }
 
-void
-Huffman
-::CollectRuns(StreamInType & fin)
+/** Run lengths below it are looked up in the flat tables of (symbol, run_len);
+    in bucketed blocks, that is every length code
+*/
+inline
+Huffman::SizeType
+DirectLength(const bool & bucketed)
 {
-    typedef     std::map<MetaSymbolType, unsigned int>  CacheType;
-    typedef     CacheType::iterator                     CacheIterType;
+    return bucketed ? Huffman::length_code_max + 1 : 32;
+}
 
-    /** Reset the input position indicator */
-    fin.clear();
-    fin.seekg(0, fin.beg);
+inline
+Huffman::SizeType
+LengthExtra(const Huffman::SizeType & code)
+{
+    return (code <= 8) ? 0 : (code - 9) / 4 + 1;
+}
 
-    if(! fin.eof())
-    {
-        CacheType   cache;          /**< Caching a position of the run in the vector(runs_) */
-        ByteType    symbol,
-                    next_symbol;
-        SizeType    run_len         = 1;
+inline
+Huffman::SizeType
+LengthBase(const Huffman::SizeType & code)
+{
+    if(code <= 8)
+        return code;
+
+    Huffman::SizeType extra = LengthExtra(code);
+    return (Huffman::SizeType(0x1) << (extra + 2)) + (((code - 9) & 0x3) << extra) + 1;
+}
 
-        BinaryStream::Read<ByteType>(fin, symbol);
+/** Call func(context, symbol, length code, piece) for each run of a block with contexts, split as the bucketed blocks split it;
+    the context is the symbol of the run, or piece, before, and 0 for the first one. Stops early when func returns false.
+*/
+template<typename FUNC>
+inline
+bool
+ScanContexts(const Huffman::ByteType * block, const Huffman::SizeType & block_len, FUNC func)
+{
+    Huffman::ByteType context = 0;
 
-        while(! fin.eof())
+    return RunScanner::Scan(block, block_len, [&](const Huffman::ByteType & symbol, const Huffman::SizeType & run_len)
+    {
+        for(Huffman::SizeType rest = run_len; rest > 0;)
         {
-            BinaryStream::Read<ByteType>(fin, next_symbol);
+            Huffman::SizeType piece = std::min(rest, Huffman::length_run_max);
 
-            if(symbol == next_symbol)
-                ++run_len;
-            else
-            {
-                /** Insert the pair into runs_;
-                    key:    pair(symbol, run_len)
-                    value:  appearance frequency of key
-                */
-                MetaSymbolType  meta_symbol = std::make_pair(symbol, run_len);
-                CacheIterType   cache_iter  = cache.find(meta_symbol);  /** Get the position from cache */
+            if(! func(context, symbol, LengthCode(piece), piece))
+                return false;
 
-                if(cache_iter == cache.end())
-                {
-                    runs_.push_back(RunType(meta_symbol, 1));           /** First appreance; freq is 1 */
-                    cache.emplace(meta_symbol, runs_.size() - 1);       /** Cache the position */
-                }
-                else
-                    ++runs_.at(cache_iter->second);                     /** Add freq */
+            context = symbol;
+            rest   -= piece;
+        }
 
-                run_len = 1;
-            }
+        return true;
+    });
+}
 
-            symbol = next_symbol;
-        }
+/** Symbol and run length of a run escaped in a sampled block, from the `literal' bits after its escape,
+    and the extra bits of its length code; false for a length code out of range
+*/
+inline
+bool
+ReadEscaped(BitReader & reader, const Huffman::SizeType literal, Huffman::ByteType & symbol, Huffman::SizeType & run_len)
+{
+    Huffman::SizeType code  = literal & ((Huffman::SizeType(0x1) << Huffman::adaptive_escape_bits) - 1);
+    Huffman::SizeType extra = LengthExtra(code);
 
-        /** Process the remaining symbol */
-        MetaSymbolType  meta_symbol = std::make_pair(symbol, run_len);
-        CacheIterType   cache_iter  = cache.find(meta_symbol);
+    if(code == 0 || code > Huffman::length_code_max)
+        return false;
 
-        if(cache_iter == cache.end())
-        {
-            runs_.push_back(RunType(meta_symbol, 1));
-            cache.emplace(meta_symbol, runs_.size() - 1);
-        }
-        else
-            ++runs_.at(cache_iter->second);
+    symbol  = Huffman::ByteType(literal >> Huffman::adaptive_escape_bits);
+    run_len = LengthBase(code);
+
+    if(extra != 0)
+    {
+        reader.Refill();
+        run_len += Huffman::SizeType(reader.Peek(extra));
+        reader.Skip(extra);
     }
+
+    return true;
 }
 
+/** Write a run of `len' bytes at out, with `room' bytes of output from out on.
+    A short run is one store of 8 bytes, when there is room for them; the bytes
+    past the run are overwritten by the next runs.
+*/
+inline
 void
-Huffman
-::CreateHuffmanTree(void)
+FillRun(Huffman::ByteType * out, const Huffman::ByteType & symbol, const Huffman::SizeType & len, const Huffman::SizeType & room)
 {
-    Heap<RunType>   heap;
-    for(auto run : runs_)
-        heap.Push(run);
-    
+    if(len <= sizeof(uint64_t) && room >= sizeof(uint64_t))
+    {
+        uint64_t word = uint64_t(symbol) * 0x0101010101010101;
+        std::memcpy(out, &word, sizeof(uint64_t));
+    }
+    else
+        std::memset(out, symbol, len);
+}
 
-    while(heap.size() > 1)
+/** Bytes of BinaryStream::WriteVarint for `value' */
+inline
+Huffman::SizeType
+VarintSize(Huffman::SizeType value)
+{
+    Huffman::SizeType len = 1;
+
+    for(; value >= 0x80; value >>= 7)
+        ++len;
+
+    return len;
+}
+
+/** 32-bit FNV-1a; names a codebook by its contents */
+inline
+uint32_t
+Fnv1a(const Huffman::ByteType * data, const Huffman::SizeType & len)
+{
+    uint32_t hash = 0x811c9dc5;
+
+    for(Huffman::SizeType i = 0; i < len; ++i)
+        hash = (hash ^ data[i]) * 0x01000193;
+
+    return hash;
+}
+
+/** Read `len' bytes of fin into `bytes'; false when fin ends before them.
+    They are grown as they arrive, so that a damaged length takes no more memory than the input has.
+*/
+template<typename STREAM_IN>
+bool
+ReadBytes(STREAM_IN & fin, std::vector<Huffman::ByteType> & bytes, const Huffman::SizeType & len)
+{
+    const   Huffman::SizeType   step    = Huffman::chunk_size * 16;
+
+    bytes.clear();
+
+    while(bytes.size() < len)
     {
-        RunType * left  = new RunType(heap.Peek());
-        heap.Pop();
+        Huffman::SizeType pos = bytes.size();
+        bytes.resize(pos + std::min(len - pos, step));
 
-        RunType * right = new RunType(heap.Peek());
-        heap.Pop();
+        fin.read((char *)&bytes[pos], std::streamsize(bytes.size() - pos));
 
-        RunType temp(left, right);
-        heap.Push(temp);
+        if(Huffman::SizeType(fin.gcount()) != bytes.size() - pos)
+            return false;
     }
 
-    root_ = new RunType(heap.Peek());
-    heap.Pop();
+    return true;
 }
 
-void
-Huffman
-::CreateRunList(RunType * node)
+/** False when a bitstream of `bitstream_len' bytes cannot decode to `out_len' bytes through `table';
+    each codeword takes a bit at least, and gives no longer a run than the longest of the table
+*/
+inline
+bool
+MayDecodeTo(const Huffman::DecodeTableType & table, const Huffman::SizeType & bitstream_len, const Huffman::SizeType & out_len)
 {
-    if(node->left == nullptr && node->right == nullptr)
+    Huffman::SizeType run_max = 0;
+
+    for(const auto & entry : table)
     {
-        if(list_.at(node->symbol) == nullptr)
-            list_.at(node->symbol) = node;
-        else
-        {
-            node->next = list_.at(node->symbol);
-            list_.at(node->symbol) = node;
-        }
+        /** The escape of a sampled block has no base length; entries of sub-tables are not runs */
+        if(entry.value == 0 && entry.extra != 0)
+            run_max = std::max(run_max, Huffman::length_run_max);
+        else if(entry.sub_bits == 0)
+            run_max = std::max(run_max, Huffman::SizeType(entry.value) + (Huffman::SizeType(0x1) << entry.extra) - 1);
     }
-    else
-    {
-        if(node->left != nullptr)
-            CreateRunList(node->left);
 
-        if(node->right != nullptr)
-            CreateRunList(node->right);
+    return out_len == 0 || (run_max > 0 && (out_len - 1) / run_max < bitstream_len * Huffman::byte_size);
+}
+
+/** Coder a task takes from the idle ones, and hands back when it ends, by an exception too */
+class BorrowedCoder
+{
+private:
+    BoundedQueue<Huffman *> &   idle_;
+    Huffman *                   coder_;
+
+public:
+    BorrowedCoder(BoundedQueue<Huffman *> & idle)
+    : idle_     (idle)
+    , coder_    (nullptr)
+    { idle_.Pop(coder_); }
+
+    ~BorrowedCoder(void)
+    { idle_.Push(coder_); }
+
+    BorrowedCoder(const BorrowedCoder &) = delete;
+    BorrowedCoder & operator=(const BorrowedCoder &) = delete;
+
+    Huffman *
+    operator->(void)
+    const
+    { return coder_; }
+};
+
+/** Stream untied from its output while in scope; a read of a tied stream flushes the output,
+    which races with a thread that writes to it, as std::cin does to std::cout
+*/
+class UntiedStream
+{
+private:
+    Huffman::StreamInType *     stream_;
+    Huffman::StreamOutType *    tie_;
+
+public:
+    UntiedStream(Huffman::StreamInType * stream)
+    : stream_   (stream)
+    , tie_      (stream != nullptr ? stream->tie(nullptr) : nullptr)
+    {}
+
+    ~UntiedStream(void)
+    {
+        if(stream_ != nullptr)
+            stream_->tie(tie_);
     }
+
+    UntiedStream(const UntiedStream &) = delete;
+    UntiedStream & operator=(const UntiedStream &) = delete;
+};
+
+} /** ns: (anonymous) */
+
+const Huffman::SizeType Huffman::byte_size;
+const Huffman::SizeType Huffman::chunk_size;
+const Huffman::SizeType Huffman::lookup_bits;
+const Huffman::SizeType Huffman::codeword_len_max;
+const Huffman::SizeType Huffman::block_size_default;
+const Huffman::SizeType Huffman::sample_chunk;
+const Huffman::SizeType Huffman::sample_escape;
+const Huffman::SizeType Huffman::context_table_max;
+const Huffman::SizeType Huffman::index_footer_size;
+const Huffman::SizeType Huffman::block_cache_default;
+const Huffman::SizeType Huffman::pipeline_slots;
+const Huffman::SizeType Huffman::length_run_max;
+const Huffman::SizeType Huffman::run_len_max;
+const Huffman::SizeType Huffman::interleave_count;
+const Huffman::SizeType Huffman::codebook_weight;
+const Huffman::SizeType Huffman::adaptive_symbol_count;
+const Huffman::SizeType Huffman::adaptive_escape_bits;
+const Huffman::SizeType Huffman::adaptive_end;
+const Huffman::SizeType Huffman::adaptive_flush;
+const BitWriter::SizeType BitWriter::slack;
+const BufferedReader::SizeType BufferedReader::chunk_size;
+const BufferedWriter::SizeType BufferedWriter::chunk_size;
+const AdaptiveTree::IndexType AdaptiveTree::none;
+
+Huffman
+::Huffman(void)
+: root_                 (nullptr)
+, block_out_            (new BufferedWriter())
+, block_size_           (block_size_default)
+, thread_count_         (1)
+, codeword_len_limit_   (codeword_len_max)
+, length_buckets_       (false)
+, interleaved_          (false)
+, sample_stride_        (1)
+, contexts_             (false)
+, pipelined_            (false)
+, adaptive_             (false)
+, block_flags_          (0)
+, block_cache_size_     (block_cache_default)
+, stats_                (nullptr)
+, optimal_bits_         (0)
+, encoded_bits_         (0)
+{
+    list_.fill(nullptr);
+    context_map_.fill(0);
+}
+
+Huffman
+::~Huffman(void)
+{
 }
 
 void
 Huffman
-::AssignCodeword(RunType * node, const CodewordType & codeword, const SizeType & codeword_len)
+::Reset(void)
 {
-    if(node->left == nullptr && node->right == nullptr)
+    runs_.clear();
+    DeleteHuffmanTree();
+    table_.clear();
+    list_.fill(nullptr);
+
+    index_.clear();
+    block_out_->Clear();
+    stream_out_.clear();
+    ClearBlockCache();
+
+    block_flags_    = 0;
+    optimal_bits_   = 0;
+    encoded_bits_   = 0;
+}
+
+bool
+Huffman
+::Compress(StreamInType & fin, StreamOutType & fout)
+{
+    return CompressStream(&fin, nullptr, 0, fout);
+}
+
+bool
+Huffman
+::Compress(const ByteType * in, const SizeType & in_len, StreamOutType & fout)
+{
+    return CompressStream(nullptr, in, in_len, fout);
+}
+
+bool
+Huffman
+::Compress(StreamInType & fin, StreamOutType & fout, const Codebook & codebook)
+{
+    /** The whole input is coded at once */
+    block_in_.clear();
+
+    while(fin.good())
     {
-        node->codeword      = codeword;
-        node->codeword_len  = codeword_len;
+        SizeType pos = block_in_.size();
+        block_in_.resize(pos + chunk_size);
+
+        fin.read((char *)&block_in_[pos], std::streamsize(chunk_size));
+        block_in_.resize(pos + SizeType(fin.gcount()));
     }
-    else
+
+    if(fin.bad())
+        return false;
+
+    return Compress(block_in_.data(), block_in_.size(), fout, codebook);
+}
+
+bool
+Huffman
+::Compress(const ByteType * in, const SizeType & in_len, StreamOutType & fout, const Codebook & codebook)
+{
+    Reset();
+
+    if(codebook.empty())
+        return false;
+
+    /** A run takes at most the longest codeword, and fewer extra bits than its length */
+    SizeType    bitstream_max   = (in_len * (codebook.codeword_len_max_ + 1) + byte_size - 1) / byte_size;
+    ByteType *  bitstream       = block_out_->Reserve(bitstream_max + BitWriter::slack);
+
+    BitWriter   writer(bitstream);
+    SizeType    bitstream_len   = 0;
+    SizeType    turn            = 0;
+
+    bool        found;
+
     {
-        AssignCodeword(node->left,  (codeword << 1) + 0, codeword_len + 1);
-        AssignCodeword(node->right, (codeword << 1) + 1, codeword_len + 1);
+        PhaseTimer timer(stats_, &StatsType::encode_time);
+
+        found           = Encode<1>(codebook.encode_table_, codebook.flags_, in, in_len, &writer, turn);
+        bitstream_len   = writer.Size(bitstream);
+    }
+
+    const   SizeType    coded_len   = sizeof(uint32_t) + VarintSize(in_len) + sizeof(uint32_t) + VarintSize(bitstream_len) + bitstream_len;
+
+    /** An input the codebook does not shrink is compressed as usual; its block is stored, or coded with a table of its own */
+    if(! found || coded_len >= in_len)
+        return CompressStream(nullptr, in, in_len, fout);
+
+    BinaryStream::Write<uint32_t>(fout, magic | codebook_version);
+    BinaryStream::WriteVarint<SizeType>(fout, in_len);
+    BinaryStream::Write<uint32_t>(fout, codebook.id_);
+    BinaryStream::WriteVarint<SizeType>(fout, bitstream_len);
+
+    fout.write((char *)bitstream, std::streamsize(bitstream_len));
+
+    if(stats_ != nullptr)
+    {
+        stats_->bytes_in    += in_len;
+        stats_->bytes_out   += coded_len;
     }
+
+    return fout.good();
 }
 
 Huffman
 ::SizeType
 Huffman
-::GetCodeword(CodewordType & codeword, const ByteType & symbol, const SizeType & run_len)
+::Compress(const ByteType * in, const SizeType & in_len, ByteType * out, const SizeType & out_len)
 {
-    RunType * n = list_.at(symbol);
-    for(; n != nullptr && n->run_len != run_len; n = n->next);
+    if(adaptive_)
+    {
+        MemoryStreamBuffer  out_buffer(out, out_len);
+        std::ostream        fout(&out_buffer);
 
-    if(n == nullptr)
-        return 0;
-    else
+        return CompressStream(nullptr, in, in_len, fout) ? out_buffer.Written() : 0;
+    }
+
+    /** The blocks this coder codes itself are coded into `out' in place */
+    Reset();
+
+    BufferedWriter writer(out, out_len);
+    CompressFramed(nullptr, in, in_len, writer);
+    writer.Flush();
+
+    return writer.good() ? writer.Size() : 0;
+}
+
+Huffman
+::SizeType
+Huffman
+::Compress(const ByteType * in, const SizeType & in_len, ByteType * out, const SizeType & out_len, const Codebook & codebook)
+{
+    MemoryStreamBuffer  out_buffer(out, out_len);
+    std::ostream        fout(&out_buffer);
+
+    return Compress(in, in_len, fout, codebook) ? out_buffer.Written() : 0;
+}
+
+Huffman
+::SizeType
+Huffman
+::CompressBound(const SizeType & in_len)
+const
+{
+    if(adaptive_)
     {
-        codeword = n->codeword;
-        return n->codeword_len;
+        /** A run takes at most the deepest codeword, and its extra bits, fewer than a ninth of its length;
+            the first run of each (symbol, length code) an escape and a literal more.
+            The stream ends with one more escape, padded to a whole byte.
+        */
+        SizeType bits = in_len * AdaptiveTree::codeword_len_max + in_len / 9
+                      + std::min(in_len, adaptive_symbol_count) * (adaptive_escape_bits + byte_size)
+                      + AdaptiveTree::codeword_len_max + adaptive_escape_bits;
+
+        return sizeof(uint32_t) + bits / byte_size + 1;
     }
+
+    /** A block that coding would not shrink is stored; its length, its flags, and its bytes */
+    auto block_bound = [&](const SizeType & len)
+    { return VarintSize(len) + 1 + len; };
+
+    /** Each block, its entry in the index, the header, the empty block at the end, and the index footer */
+    SizeType block_count    = in_len / block_size_;
+    SizeType last_len       = in_len % block_size_;
+
+    SizeType bound = sizeof(uint32_t) + 1 + VarintSize(block_count + 1) + index_footer_size
+                   + block_count * (block_bound(block_size_) + VarintSize(block_bound(block_size_)) + VarintSize(block_size_));
+
+    if(last_len > 0)
+        bound += block_bound(last_len) + VarintSize(block_bound(last_len)) + VarintSize(last_len);
+
+    return bound;
+}
+
+Huffman
+::SizeType
+Huffman
+::CompressBound(const SizeType & in_len, const Codebook &)
+const
+{
+    /** An input the codebook does not shrink is compressed as usual; otherwise the output is smaller than the input */
+    return CompressBound(in_len);
 }
 
 void
 Huffman
-::WriteHeader(StreamInType & fin, StreamOutType & fout)
+::Train(const std::vector<std::pair<const ByteType *, SizeType> > & samples, Codebook & codebook)
 {
-    uint16_t run_size = uint16_t(runs_.size());
-    BinaryStream::Write<uint16_t>(fout, run_size);
+    Reset();
+    block_flags_ = block_bucketed;
 
-    fin.clear();
-    fin.seekg(0, fin.end);
+    /** Every length code of every symbol, in order of the meta symbol;
+        a run not seen in the samples keeps a frequency of 1, and gets a long codeword
+    */
+    for(SizeType symbol = 0; symbol <= ascii_max; ++symbol)
+        for(SizeType code = 1; code <= length_code_max; ++code)
+            runs_.push_back(RunType(ByteType(symbol), code, 1));
 
-    uint32_t fin_size = uint32_t(fin.tellg());
-    BinaryStream::Write<uint32_t>(fout, SizeType(fin.tellg()));
+    for(const auto & sample : samples)
+    {
+        RunScanner::Scan(sample.first, sample.second, [this](const ByteType & symbol, const SizeType & run_len)
+        {
+            for(SizeType rest = run_len; rest > 0; rest -= std::min(rest, length_run_max))
+                runs_[symbol * length_code_max + LengthCode(std::min(rest, length_run_max)) - 1].freq += codebook_weight;
 
-    for(auto run : runs_)
+            return true;
+        });
+    }
+
+    CreateHuffmanTree();
+    AssignCodeword(root_, 0, 0);
+    DeleteHuffmanTree();
+
+    /** A codebook codes no block of its own, and adds nothing to the cost of the limit */
+    SizeType optimal_bits;
+    LimitCodewordLength(optimal_bits);
+
+    BuildCodebook(codebook);
+}
+
+bool
+Huffman
+::BuildCodebook(Codebook & codebook)
+{
+    /** runs_ has to hold each length code of each symbol once, with lengths of a prefix code */
+    if(runs_.size() != (ascii_max + 1) * length_code_max)
+        return false;
+
+    uint64_t    kraft           = 0;
+    SizeType    codeword_len    = 0;
+
+    for(SizeType i = 0; i < runs_.size(); ++i)
     {
-        BinaryStream::Write<ByteType>(fout, run.symbol);
-        BinaryStream::Write<SizeType>(fout, run.run_len);
-        BinaryStream::Write<SizeType>(fout, run.freq);
+        const RunType & run = runs_.at(i);
+
+        if(run.symbol != i / length_code_max || run.run_len != i % length_code_max + 1)
+            return false;
+
+        if(run.codeword_len == 0 || run.codeword_len > codeword_len_max)
+            return false;
+
+        kraft          += uint64_t(0x1) << (codeword_len_max - run.codeword_len);
+        codeword_len    = std::max(codeword_len, run.codeword_len);
     }
+
+    if(kraft > (uint64_t(0x1) << codeword_len_max))
+        return false;
+
+    AssignCanonicalCodeword();
+    CreateEncodeTable();
+    CreateDecodeTable();
+
+    codebook.flags_             = block_flags_;
+    codebook.codeword_len_max_  = codeword_len;
+    codebook.encode_table_      = encode_table_;
+    codebook.decode_table_      = table_;
+
+    /** Every slot of encode_table_ is zero between blocks */
+    std::fill(encode_table_.begin(), encode_table_.end(), EncodeEntryType());
+
+    block_out_->Clear();
+    BinaryStream::Write<ByteType>(*block_out_, block_flags_);
+    WriteRunTable(*block_out_);
+
+    codebook.data_.assign(block_out_->Data(), block_out_->Data() + block_out_->Size());
+    codebook.id_ = Fnv1a(codebook.data_.data(), codebook.data_.size());
+
+    return true;
 }
 
-Huffman::
-SizeType
-Huffman::
-ReadHeader(StreamInType & fin)
+bool
+Huffman
+::WriteCodebook(StreamOutType & fout, const Codebook & codebook)
 {
-    typedef     std::map<MetaSymbolType, unsigned int>  CacheType;
-    typedef     CacheType::iterator                     CacheIterType;
+    if(codebook.empty())
+        return false;
 
-    fin.clear();
-    fin.seekg(0, fin.beg);
+    BinaryStream::Write<uint32_t>(fout, codebook_magic);
+    BinaryStream::Write<uint32_t>(fout, codebook.id_);
+    fout.write((char *)codebook.data_.data(), std::streamsize(codebook.data_.size()));
 
-    uint16_t run_size;
-    BinaryStream::Read<uint16_t>(fin, run_size);
+    return fout.good();
+}
 
-    uint32_t fout_size;
-    BinaryStream::Read<uint32_t>(fin, fout_size);
+bool
+Huffman
+::ReadCodebook(StreamInType & fin, Codebook & codebook)
+{
+    Reset();
 
-    runs_.clear();
+    uint32_t signature  = 0;
+    uint32_t id         = 0;
 
-    for(int i = 0; i < run_size; ++i)
-    {
-        ByteType symbol;
-        BinaryStream::Read<ByteType>(fin, symbol);
+    BinaryStream::Read<uint32_t>(fin, signature);
+    BinaryStream::Read<uint32_t>(fin, id);
+    BinaryStream::Read<ByteType>(fin, block_flags_);
 
-        SizeType run_len;
-        BinaryStream::Read<SizeType>(fin, run_len);
+    if(! fin.good() || signature != codebook_magic || block_flags_ != block_bucketed)
+        return false;
 
-        SizeType freq;
-        BinaryStream::Read<SizeType>(fin, freq);
+    /** The codebook is only replaced by a whole one */
+    Codebook read;
 
-        Run temp = Run(symbol, run_len, freq);
-        runs_.push_back(temp);
-    }
+    if(! ReadRunTable(fin) || ! BuildCodebook(read) || read.id_ != id)
+        return false;
 
-    return SizeType(fout_size);
+    codebook = std::move(read);
+    return true;
 }
 
-void
+bool
 Huffman
-::Encode(StreamInType & fin, StreamOutType & fout)
+::CompressStream(StreamInType * fin, const ByteType * in, const SizeType & in_len, StreamOutType & fout)
 {
-    /** Reset the input position indicator */
-    fin.clear();
-    fin.seekg(0, fin.beg);
+    Reset();
 
-    if(! fin.eof())
+    if(adaptive_)
     {
-        const   SizeType        bufstat_max     = buffer_size;
-                SizeType        bufstat_free    = bufstat_max;
-                CodewordType    buffer          = 0;
+        /** One pass; all of it is encoding */
+        PhaseTimer      timer(stats_, &StatsType::encode_time);
+
+        AdaptiveEncoder encoder(fout);
+        SizeType        read = in_len;
 
-                ByteType        symbol,
-                                next_symbol;
-                SizeType        run_len         = 1;
+        bool            written = true;
 
-        BinaryStream::Read<ByteType>(fin, symbol);
+        if(fin == nullptr)
+            written = encoder.Write(in, in_len);
 
-        while(! fin.eof())
+        while(fin != nullptr && fin->good() && written)
         {
-            BinaryStream::Read<ByteType>(fin, next_symbol);
+            block_in_.resize(chunk_size);
+            fin->read((char *)block_in_.data(), std::streamsize(chunk_size));
 
-            if(symbol == next_symbol)
-                ++run_len;
-            else
-            {
-                /** Write the codeword to fout */
+            written = encoder.Write(block_in_.data(), SizeType(fin->gcount()));
+            read += SizeType(fin->gcount());
+        }
 
-                CodewordType    codeword;
-                SizeType        codeword_len = GetCodeword(codeword, symbol, run_len);
+        written = encoder.Close() && written;
 
-                if(codeword_len == 0)
-                    return; /* TODO: Exception (Codeword not found) */
+        if(stats_ != nullptr)
+        {
+            stats_->bytes_in    += read;
+            stats_->bytes_out   += encoder.Size();
+        }
 
-                while(codeword_len >= bufstat_free)
-                {
-                    buffer <<= bufstat_free;
-                    buffer += (codeword >> (codeword_len - bufstat_free));
-                    codeword = codeword % (0x1 << codeword_len - bufstat_free);
-                    codeword_len -= bufstat_free;
+        return written && (fin == nullptr || ! fin->bad());
+    }
 
-                    BinaryStream::Write<CodewordType>(fout, buffer, false);
+    BufferedWriter writer(fout, stream_out_);
+    CompressFramed(fin, in, in_len, writer);
+    writer.Flush();
 
-                    buffer = 0;
-                    bufstat_free = bufstat_max;
-                }
+    return fout.good() && (fin == nullptr || ! fin->bad());
+}
 
-                buffer <<= codeword_len;
-                buffer += codeword;
-                bufstat_free -= codeword_len;
-                run_len = 1;
-            }
+void
+Huffman
+::CompressFramed(StreamInType * fin, const ByteType * in, const SizeType & in_len, BufferedWriter & fout)
+{
+    WriteHeader(fout);
+    CompressBlocks(fin, in, in_len, fout, index_);
 
-            symbol = next_symbol;
-        }
+    /** A block of no bytes ends the stream */
+    BinaryStream::WriteVarint<SizeType>(fout, 0);
 
-        /** Process the remaining symbol */
-        if(bufstat_free != bufstat_max)
+    WriteIndex(fout, index_);
+
+    if(stats_ != nullptr)
+    {
+        /** Header, blocks, the empty block, and the index; WriteIndex leaves the index in block_out_ */
+        stats_->bytes_out += sizeof(uint32_t) + 1 + block_out_->Size() + index_footer_size;
+
+        for(const auto & entry : index_)
         {
-            buffer <<= bufstat_free;
-            BinaryStream::Write<CodewordType>(fout, buffer, true);
+            stats_->bytes_in    += entry.raw_size;
+            stats_->bytes_out   += entry.size;
         }
     }
 }
 
 void
-Huffman::
-Decode(StreamInType & fin, StreamOutType & fout, const SizeType & fout_size)
+Huffman
+::CompressBlocks(StreamInType * fin, const ByteType * in, const SizeType & in_len, BufferedWriter & fout, IndexType & index)
 {
-    const   SizeType            bufstat_max     = buffer_size;
-            SizeType            bufstat_free    = bufstat_max;
-            CodewordType        buffer          = 0;
-            Run *               run             = root_;
+    /** Blocks are read from fin, or are slices of `in' when fin is nullptr */
+    SizeType in_pos = 0;
 
-    fout.clear();
-    fout.seekp(0, fin.beg);
-
-    while(! fin.eof())
+    auto next_block = [&](std::vector<ByteType> & input, const ByteType * & data, SizeType & len)
     {
-        BinaryStream::Read<CodewordType>(fin, buffer);
-        bufstat_free = 0;
+        if(fin != nullptr)
+        {
+            input.resize(block_size_);
+
+            /** gcount is of the last read; once the stream has ended, nothing is read */
+            SizeType got = 0;
+
+            if(fin->good())
+            {
+                fin->read((char *)&input[0], std::streamsize(input.size()));
+                got = SizeType(fin->gcount());
+            }
 
-        while(bufstat_free < bufstat_max)
+            input.resize(got);
+
+            data    = input.data();
+            len     = input.size();
+        }
+        else
         {
-            if(buffer / (0x1 << (buffer_size - 1)) == zerobit)
-                run = run->left;
-            else
-                run = run->right;
+            data    = in + in_pos;
+            len     = std::min(block_size_, in_len - in_pos);
+
+            in_pos += len;
+        }
+
+        return len > 0;
+    };
+
+    /** Pipelined, fin is read on one thread while fout is written on another */
+    UntiedStream untied(pipelined_ ? fin : nullptr);
 
-            buffer <<= 0x1;
-            ++bufstat_free;
+    /** Output in place has no writing to overlap with the coding */
+    if(thread_count_ <= 1 && pipelined_ && ! fout.InPlace())
+    {
+        /** A reader thread fills the slots, this coder codes them, and a writer thread drains them;
+            each slot goes around the three queues, and a stage that runs ahead waits for a free one.
+            A stage that throws closes the queues around it, so that the others end, and the
+            exception is thrown again here; one thrown here ends and joins the stages as well.
+        */
+        struct Slot
+        {
+            std::vector<ByteType>   input;
+            const ByteType *        data;
+            SizeType                len;
+            BufferedWriter          output;
+        };
+
+        std::vector<Slot>       slots(pipeline_slots);
+        BoundedQueue<Slot *>    empty(pipeline_slots);
+        BoundedQueue<Slot *>    filled(pipeline_slots);
+        BoundedQueue<Slot *>    coded(pipeline_slots);
+
+        for(auto & slot : slots)
+            empty.Push(&slot);
 
-            if(run->codeword_len > 0)
+        StageThread reader([&]
+        {
+            Slot * slot;
+
+            while(empty.Pop(slot) && next_block(slot->input, slot->data, slot->len))
             {
-                for(int i = 0; i < run->run_len; ++i)
+                /** A slice of memory is touched a page at a time, so that a mapped file is read from the device ahead of the coder */
+                if(fin == nullptr)
                 {
-                    BinaryStream::Write<ByteType>(fout, run->symbol);
+                    const   SizeType    page_size   = 4096;
+                    volatile ByteType   touched     = 0;
 
-                    if(fout.tellp() >= fout_size)
-                        return;
+                    for(SizeType pos = 0; pos < slot->len; pos += page_size)
+                        touched = touched ^ slot->data[pos];
                 }
 
-                run = root_;
+                filled.Push(slot);
             }
-        }
-    }
+
+            filled.Close();
+        }, [&] { empty.Close(); filled.Close(); });
+
+        StageThread writer([&]
+        {
+            Slot * slot;
+
+            while(coded.Pop(slot))
+            {
+                fout.write((char *)slot->output.Data(), std::streamsize(slot->output.Size()));
+                empty.Push(slot);
+            }
+        }, [&] { coded.Close(); empty.Close(); });
+
+        Slot * slot;
+
+        while(filled.Pop(slot))
+        {
+            slot->output.Clear();
+            CompressBlock(slot->data, slot->len, slot->output);
+
+            IndexEntryType entry = { 0, slot->output.Size(), 0, slot->len };
+            index.push_back(entry);
+
+            coded.Push(slot);
+        }
+
+        coded.Close();
+        writer.Join();
+
+        empty.Close();
+        reader.Join();
+
+        return;
+    }
+
+    if(thread_count_ <= 1)
+    {
+        /** Without workers, each block is coded as soon as it is read, by this coder and into its buffers;
+            or into the output, where it is in place, and Unreserve can still take back a block that is stored instead
+        */
+        const ByteType *    data;
+        SizeType            len;
+
+        while(next_block(block_in_, data, len))
+        {
+            if(fout.InPlace())
+            {
+                SizeType start = fout.Size();
+                CompressBlock(data, len, fout);
+
+                IndexEntryType entry = { 0, fout.Size() - start, 0, len };
+                index.push_back(entry);
+
+                continue;
+            }
+
+            block_out_->Clear();
+            CompressBlock(data, len, *block_out_);
+
+            fout.write((char *)block_out_->Data(), std::streamsize(block_out_->Size()));
+
+            IndexEntryType entry = { 0, block_out_->Size(), 0, len };
+            index.push_back(entry);
+        }
+
+        return;
+    }
+
+    /** A block, coded by a worker into its own buffer */
+    struct Block
+    {
+        std::vector<ByteType>   input;
+        const ByteType *        data;
+        SizeType                len;
+        BufferedWriter          output;
+        SizeType                optimal_bits;
+        SizeType                encoded_bits;
+        StatsType               stats;
+    };
+
+    typedef     std::shared_ptr<Block>                          BlockPointerType;
+    typedef     std::pair<BlockPointerType, std::future<void> > PendingType;
+
+    BoundedQueue<Huffman *> idle(thread_count_);
+    LendWorkers(idle);
+
+    /** Pipelined, the coded blocks are written by a thread of their own, while the next ones are read */
+    const   bool            pipelined   = pipelined_ && ! fout.InPlace();
+
+    BoundedQueue<BlockPointerType>  coded(pipeline_slots);
+    std::unique_ptr<StageThread>    writer;
+
+    if(pipelined)
+        writer.reset(new StageThread([&]
+        {
+            BlockPointerType block;
+
+            while(coded.Pop(block))
+                fout.write((char *)block->output.Data(), std::streamsize(block->output.Size()));
+        }, [&] { coded.Close(); }));
+
+    ThreadPool              pool(thread_count_);
+    std::deque<PendingType> pending;    /**< Blocks in order of the input */
+
+    /** Reading stays ahead of the workers by a bounded number of blocks */
+    const   SizeType        pending_max = 2 * thread_count_;
+
+    while(true)
+    {
+        while(pending.size() < pending_max)
+        {
+            BlockPointerType block = std::make_shared<Block>();
+
+            if(! next_block(block->input, block->data, block->len))
+                break;
+
+            SizeType    codeword_len_limit  = codeword_len_limit_;
+            bool        length_buckets      = length_buckets_;
+            bool        interleaved         = interleaved_;
+            SizeType    sample_stride       = sample_stride_;
+            bool        contexts            = contexts_;
+            bool        timed               = stats_ != nullptr;
+
+            pending.push_back(PendingType(block, pool.Submit([block, codeword_len_limit, length_buckets, interleaved, sample_stride, contexts, timed, &idle]
+            {
+                BorrowedCoder coder(idle);
+
+                coder->codeword_len_limit_  = codeword_len_limit;
+                coder->length_buckets_      = length_buckets;
+                coder->interleaved_         = interleaved;
+                coder->sample_stride_       = sample_stride;
+                coder->contexts_            = contexts;
+                coder->stats_               = timed ? &block->stats : nullptr;
+                coder->optimal_bits_        = 0;
+                coder->encoded_bits_        = 0;
+                coder->CompressBlock(block->data, block->len, block->output);
+
+                block->optimal_bits = coder->optimal_bits_;
+                block->encoded_bits = coder->encoded_bits_;
+            })));
+        }
+
+        if(pending.empty())
+            break;
+
+        /** Blocks are written in order, whichever finishes first */
+        pending.front().second.get();
+
+        BlockPointerType block = pending.front().first;
+        pending.pop_front();
+
+        /** A writer that threw has closed its queue; Join throws it again */
+        if(pipelined && ! coded.Push(block))
+            break;
+
+        if(! pipelined)
+            fout.write((char *)block->output.Data(), std::streamsize(block->output.Size()));
+
+        IndexEntryType entry = { 0, block->output.Size(), 0, block->len };
+        index.push_back(entry);
+
+        optimal_bits_ += block->optimal_bits;
+        encoded_bits_ += block->encoded_bits;
+
+        if(stats_ != nullptr)
+            *stats_ += block->stats;
+    }
+
+    if(pipelined)
+    {
+        coded.Close();
+        writer->Join();
+    }
+}
+
+void
+Huffman
+::LendWorkers(BoundedQueue<Huffman *> & idle)
+{
+    /** A coder for each thread, kept with the memory it grew for the next stream;
+        each task takes a free one from `idle' as a BorrowedCoder, which puts it back when the task ends
+    */
+    while(workers_.size() < thread_count_)
+        workers_.push_back(std::unique_ptr<Huffman>(new Huffman()));
+
+    for(SizeType i = 0; i < thread_count_; ++i)
+        idle.Push(workers_[i].get());
+}
+
+void
+Huffman
+::CompressBlock(const ByteType * block, const SizeType & block_len, BufferedWriter & fout)
+{
+    if(contexts_ && CompressContexts(block, block_len, fout))
+        return;
+
+    /** A block of one chunk is counted whole */
+    const   bool        sampled     = sample_stride_ > 1 && block_len > sample_chunk;
+
+    block_flags_ = (length_buckets_ || sampled ? block_bucketed : 0)
+                 | (interleaved_ ? block_interleaved : 0)
+                 | (sampled ? block_sampled : 0);
+
+    runs_.clear();
+
+    SizeType counted_len;
+
+    {
+        PhaseTimer timer(stats_, &StatsType::collect_runs_time);
+        counted_len = CollectRuns(block, block_len, sampled ? sample_stride_ : 1);
+    }
+
+    const   SizeType    start       = fout.Size();
+    const   SizeType    stored_size = VarintSize(block_len) + 1 + block_len;
+
+    /** No code takes fewer bits than the entropy of the runs, and no entry of the run table fewer than 3 bytes;
+        a block that would not shrink even then is stored, before any tree is built.
+        The entropy of a sample is scaled up to the block, as an estimate.
+    */
+    {
+        PhaseTimer timer(stats_, &StatsType::create_tree_time);
+
+        SizeType run_count = 0;
+        for(const auto & run : runs_)
+            run_count += run.freq;
+
+        double entropy_bits = 0;
+        for(const auto & run : runs_)
+            entropy_bits += double(run.freq) * std::log2(double(run_count) / double(run.freq));
+
+        entropy_bits *= double(block_len) / double(counted_len);
+
+        if(SizeType(entropy_bits) / byte_size + 3 * runs_.size() + 2 >= block_len)
+        {
+            StoreBlock(block, block_len, fout);
+            return;
+        }
+    }
+
+    if(sampled)
+    {
+        /** The runs not in the sample are about as frequent as the ones seen once in it */
+        SizeType once = 0;
+        for(const auto & run : runs_)
+            once += (run.freq == 1);
+
+        runs_.push_back(RunType(0, sample_escape, std::max(once, SizeType(1))));
+    }
+
+    SizeType codeword_bits;
+    SizeType optimal_bits;
+
+    {
+        PhaseTimer timer(stats_, &StatsType::create_tree_time);
+
+        CreateHuffmanTree();
+        AssignCodeword(root_, 0, 0);
+        DeleteHuffmanTree();
+
+        codeword_bits = LimitCodewordLength(optimal_bits);
+        AssignCanonicalCodeword();
+    }
+
+    SizeType bitstream_bits = codeword_bits;
+
+    /** Only a table that is written is counted; the frequencies of a sampled block are those of its sample */
+    auto count_table = [&](void)
+    {
+        optimal_bits_ += optimal_bits;
+        encoded_bits_ += codeword_bits;
+
+        if(stats_ == nullptr)
+            return;
+
+        stats_->meta_symbol_count   = std::max(stats_->meta_symbol_count, runs_.size());
+
+        for(const auto & run : runs_)
+            stats_->codeword_len_max    = std::max(stats_->codeword_len_max, run.codeword_len);
+
+        if(! sampled)
+        {
+            stats_->codeword_bits           += codeword_bits;
+            stats_->optimal_codeword_bits   += optimal_bits;
+
+            for(const auto & run : runs_)
+                stats_->run_count           += run.freq;
+        }
+    };
+
+    if(sampled)
+    {
+        BinaryStream::WriteVarint<SizeType>(fout, block_len);
+        BinaryStream::Write<ByteType>(fout, block_flags_);
+        WriteRunTable(fout);
+
+        PhaseTimer timer(stats_, &StatsType::encode_time);
+        CreateEncodeTable();
+
+        /** The size of the bitstreams is only known once they are coded; coding stops when they take no less than the block */
+        const   SizeType    streams     = (block_flags_ & block_interleaved) ? interleave_count : 1;
+        const   SizeType    header_len  = fout.Size() - start;
+        const   SizeType    limit       = stored_size - std::min(stored_size, header_len);
+
+        /** A chunk may be all escaped runs; a run then takes a codeword, a symbol, a length code and its extra bits */
+        const   SizeType    run_max     = (codeword_len_max + byte_size + adaptive_escape_bits + length_extra_max + byte_size - 1) / byte_size;
+        const   SizeType    region      = limit + sample_chunk * run_max + BitWriter::slack;
+
+        /** One bitstream is coded into the output in place, after the room its size takes at most;
+            interleaved ones into regions of streams_, to be put together
+        */
+        const   SizeType    size_len    = VarintSize(limit);
+        ByteType *          out;
+
+        if(streams == 1)
+            out = fout.Reserve(size_len + region) + size_len;
+        else
+        {
+            streams_.resize(streams * region);
+            out = streams_.data();
+        }
+
+        SizeType sizes[interleave_count] = { 0 };
+
+        bool coded = (streams == 1) ? EncodeSampled<1>(block, block_len, limit, out, region, sizes)
+                                    : EncodeSampled<interleave_count>(block, block_len, limit, out, region, sizes);
+
+        SizeType total = 0;
+        for(SizeType i = 0; i < streams; ++i)
+            total += sizes[i] + (i + 1 < streams ? VarintSize(sizes[i]) : 0);
+
+        /** Every slot is zero between blocks */
+        const   SizeType    direct_len  = DirectLength(true);
+
+        for(const auto & run : runs_)
+            if(run.run_len < direct_len)
+                encode_table_[run.symbol * direct_len + run.run_len] = EncodeEntryType();
+
+        if(! coded || header_len + VarintSize(total) + total >= stored_size)
+        {
+            fout.Unreserve(fout.Size() - start);
+            StoreBlock(block, block_len, fout);
+            return;
+        }
+
+        if(streams == 1)
+        {
+            /** The size goes in front of the bitstream, which moves up to it when the size takes less than the room */
+            BufferedWriter size_out(out - size_len, size_len);
+            BinaryStream::WriteVarint<SizeType>(size_out, total);
+
+            if(VarintSize(total) < size_len)
+                std::memmove(out - size_len + VarintSize(total), out, total);
+
+            fout.Unreserve(size_len + region - VarintSize(total) - total);
+        }
+        else
+        {
+            BinaryStream::WriteVarint<SizeType>(fout, total);
+
+            for(SizeType i = 0; i + 1 < streams; ++i)
+                BinaryStream::WriteVarint<SizeType>(fout, sizes[i]);
+
+            for(SizeType i = 0; i < streams; ++i)
+                fout.write((char *)(out + i * region), std::streamsize(sizes[i]));
+        }
+
+        count_table();
+        return;
+    }
+
+    /** Extra bits follow the length codes; a lone run emits no bits at all */
+    if((block_flags_ & block_bucketed) && runs_.size() > 1)
+        for(auto run : runs_)
+            bitstream_bits += run.freq * LengthExtra(run.run_len);
+
+    BinaryStream::WriteVarint<SizeType>(fout, block_len);
+    BinaryStream::Write<ByteType>(fout, block_flags_);
+    WriteRunTable(fout);
+
+    SizeType bitstream_len = (bitstream_bits + byte_size - 1) / byte_size;
+
+    /** The size the coded block takes at most; the interleaved bitstreams end in a partial byte each, and have sizes */
+    SizeType coded_len = bitstream_len;
+    if(block_flags_ & block_interleaved)
+        coded_len += (interleave_count - 1) * (1 + VarintSize(bitstream_len));
+
+    if(fout.Size() - start + VarintSize(coded_len) + coded_len >= stored_size)
+    {
+        fout.Unreserve(fout.Size() - start);
+        StoreBlock(block, block_len, fout);
+        return;
+    }
+
+    count_table();
+
+    PhaseTimer timer(stats_, &StatsType::encode_time);
+    CreateEncodeTable();
+
+    if(block_flags_ & block_interleaved)
+    {
+        /** Any one of the bitstreams may take all the bits; they are coded apart, then put together */
+        SizeType region = bitstream_len + BitWriter::slack;
+        streams_.resize(interleave_count * region);
+
+        BitWriter writers[interleave_count];
+        for(SizeType i = 0; i < interleave_count; ++i)
+            writers[i] = BitWriter(&streams_[i * region]);
+
+        SizeType turn = 0;
+        Encode<interleave_count>(encode_table_, block_flags_, block, block_len, writers, turn);
+
+        SizeType sizes[interleave_count];
+        SizeType total = 0;
+
+        for(SizeType i = 0; i < interleave_count; ++i)
+        {
+            sizes[i] = writers[i].Size(&streams_[i * region]);
+            total   += sizes[i] + (i + 1 < interleave_count ? VarintSize(sizes[i]) : 0);
+        }
+
+        BinaryStream::WriteVarint<SizeType>(fout, total);
+
+        for(SizeType i = 0; i + 1 < interleave_count; ++i)
+            BinaryStream::WriteVarint<SizeType>(fout, sizes[i]);
+
+        for(SizeType i = 0; i < interleave_count; ++i)
+            fout.write((char *)&streams_[i * region], std::streamsize(sizes[i]));
+    }
+    else
+    {
+        BinaryStream::WriteVarint<SizeType>(fout, bitstream_len);
+
+        ByteType *  bitstream   = fout.Reserve(bitstream_len + BitWriter::slack);
+        BitWriter   writer(bitstream);
+        SizeType    turn        = 0;
+
+        Encode<1>(encode_table_, block_flags_, block, block_len, &writer, turn);
+        fout.Unreserve(BitWriter::slack);
+    }
+
+    /** Every slot is zero between blocks */
+    const   SizeType    direct_len  = DirectLength((block_flags_ & block_bucketed) != 0);
+
+    for(const auto & run : runs_)
+        if(run.run_len < direct_len)
+            encode_table_[run.symbol * direct_len + run.run_len] = EncodeEntryType();
+}
+
+void
+Huffman
+::StoreBlock(const ByteType * block, const SizeType & block_len, BufferedWriter & fout)
+{
+    block_flags_ = block_stored;
+
+    BinaryStream::WriteVarint<SizeType>(fout, block_len);
+    BinaryStream::Write<ByteType>(fout, block_flags_);
+    fout.write((char *)block, std::streamsize(block_len));
+
+    if(stats_ != nullptr)
+        ++stats_->stored_block_count;
+}
+
+template<Huffman::SizeType STREAMS>
+bool
+Huffman
+::EncodeSampled(const ByteType * block, const SizeType & block_len, const SizeType & limit, ByteType * out, const SizeType & region, SizeType * sizes)
+{
+    BitWriter writers[STREAMS];
+    for(SizeType i = 0; i < STREAMS; ++i)
+        writers[i] = BitWriter(out + i * region);
+
+    /** Coded a chunk at a time, so that the bitstreams stop short of the end of their regions */
+    SizeType turn = 0;
+
+    for(SizeType pos = 0; pos < block_len; pos += sample_chunk)
+    {
+        if(! Encode<STREAMS>(encode_table_, block_flags_, block + pos, std::min(sample_chunk, block_len - pos), writers, turn))
+            return false;
+
+        SizeType total = 0;
+        for(SizeType i = 0; i < STREAMS; ++i)
+            total += sizes[i] = writers[i].Size(out + i * region);
+
+        if(total >= limit)
+            return false;
+    }
+
+    return true;
+}
+
+bool
+Huffman
+::CompressContexts(const ByteType * block, const SizeType & block_len, BufferedWriter & fout)
+{
+    const   SizeType    symbol_count    = ascii_max + 1;
+    const   SizeType    direct_len      = DirectLength(true);
+    const   SizeType    table_len       = symbol_count * direct_len;    /**< Slots of each table in direct_ and context_encode_ */
+
+    block_flags_ = block_bucketed | block_contexts;
+
+    SizeType distinct = 0;      /**< (symbol, length code) of the block */
+
+    {
+        PhaseTimer timer(stats_, &StatsType::collect_runs_time);
+
+        /** Runs by (context, symbol); the (symbol, length code) seen are marked in direct_, whose slots are zero between blocks */
+        pairs_.assign(symbol_count * symbol_count, 0);
+        direct_.resize(std::max(direct_.size(), table_len), 0);
+
+        ScanContexts(block, block_len, [&](const ByteType & context, const ByteType & symbol, const SizeType & code, const SizeType &)
+        {
+            ++pairs_[context * symbol_count + symbol];
+
+            uint32_t & seen = direct_[symbol * direct_len + code];
+            distinct   += (seen == 0);
+            seen        = 1;
+
+            return true;
+        });
+
+        std::fill(direct_.begin(), direct_.begin() + table_len, 0);
+    }
+
+    SizeType table_count;
+
+    {
+        PhaseTimer timer(stats_, &StatsType::create_tree_time);
+
+        std::vector<SizeType> counts(symbol_count, 0);          /**< Runs of each symbol */
+        std::vector<SizeType> context_counts(symbol_count, 0);  /**< Runs after each symbol */
+        SizeType total = 0;
+
+        for(SizeType context = 0; context < symbol_count; ++context)
+            for(SizeType symbol = 0; symbol < symbol_count; ++symbol)
+            {
+                counts[symbol]          += pairs_[context * symbol_count + symbol];
+                context_counts[context] += pairs_[context * symbol_count + symbol];
+                total                   += pairs_[context * symbol_count + symbol];
+            }
+
+        SizeType symbols = 0;
+        for(auto count : counts)
+            symbols += (count > 0);
+
+        /** An entry of a run table takes 3 bytes, for each length code of a symbol */
+        const   double      entry_bits  = 24.0 * double(distinct) / double(std::max(symbols, SizeType(1)));
+
+        /** Bits a table of its own saves a context; its runs coded by their own frequencies, against those of the whole block,
+            less the entries of the table, and of the map
+        */
+        std::vector<std::pair<double, SizeType> > gains;
+
+        for(SizeType context = 0; context < symbol_count; ++context)
+        {
+            if(context_counts[context] == 0)
+                continue;
+
+            double gain = -2.0 * byte_size;
+
+            for(SizeType symbol = 0; symbol < symbol_count; ++symbol)
+            {
+                SizeType count = pairs_[context * symbol_count + symbol];
+                if(count == 0)
+                    continue;
+
+                gain += double(count) * (std::log2(double(total) / double(counts[symbol]))
+                                       - std::log2(double(context_counts[context]) / double(count)))
+                      - entry_bits;
+            }
+
+            if(gain > 0)
+                gains.push_back(std::make_pair(gain, context));
+        }
+
+        /** A block in which no context pays for a table is coded as usual */
+        if(gains.empty())
+            return false;
+
+        std::sort(gains.begin(), gains.end(), [](const std::pair<double, SizeType> & lhs, const std::pair<double, SizeType> & rhs)
+        { return lhs.first > rhs.first; });
+
+        gains.resize(std::min(gains.size(), context_table_max - 1));
+        table_count = gains.size() + 1;
+
+        /** Frequencies each table starts from; the first has those of the whole block */
+        std::vector<const SizeType *>   dists(table_count, counts.data());
+        std::vector<SizeType>           dist_counts(table_count, total);
+
+        context_map_.fill(0);
+
+        for(SizeType table = 1; table < table_count; ++table)
+        {
+            SizeType context = gains[table - 1].second;
+
+            context_map_[context]   = ByteType(table);
+            dists[table]            = &pairs_[context * symbol_count];
+            dist_counts[table]      = context_counts[context];
+        }
+
+        /** Bits of a run of each symbol in each table; a symbol missing from a table takes about one bit more than its rarest run */
+        std::vector<double> costs(table_count * symbol_count);
+
+        for(SizeType table = 0; table < table_count; ++table)
+            for(SizeType symbol = 0; symbol < symbol_count; ++symbol)
+            {
+                SizeType count = dists[table][symbol];
+                costs[table * symbol_count + symbol] = std::log2(double(dist_counts[table]) / double(std::max(count, SizeType(1)))) + (count == 0);
+            }
+
+        /** The other contexts are clustered; each joins the table whose frequencies code its runs in the fewest bits,
+            the entries it adds to the table included
+        */
+        for(SizeType context = 0; context < symbol_count; ++context)
+        {
+            if(context_counts[context] == 0 || context_map_[context] != 0)
+                continue;
+
+            SizeType    best        = 0;
+            double      best_bits   = std::numeric_limits<double>::max();
+
+            for(SizeType table = 0; table < table_count; ++table)
+            {
+                double bits = 0;
+
+                for(SizeType symbol = 0; symbol < symbol_count; ++symbol)
+                {
+                    SizeType count = pairs_[context * symbol_count + symbol];
+                    if(count == 0)
+                        continue;
+
+                    bits += double(count) * costs[table * symbol_count + symbol] + (dists[table][symbol] == 0 ? entry_bits : 0);
+                }
+
+                if(bits < best_bits)
+                {
+                    best        = table;
+                    best_bits   = bits;
+                }
+            }
+
+            context_map_[context] = ByteType(best);
+        }
+    }
+
+    /** One more table, of every run of the block, which the tables of the contexts have to beat */
+    const   SizeType    whole   = table_count;
+
+    {
+        PhaseTimer timer(stats_, &StatsType::collect_runs_time);
+
+        /** Runs of each table; positions in them, plus one, by (table, symbol, length code) */
+        if(context_runs_.size() < table_count + 1)
+            context_runs_.resize(table_count + 1);
+
+        for(SizeType table = 0; table <= whole; ++table)
+            context_runs_[table].clear();
+
+        direct_.resize(std::max(direct_.size(), (table_count + 1) * table_len), 0);
+
+        auto count = [&](const SizeType & table, const ByteType & symbol, const SizeType & code)
+        {
+            RunArrayType &  runs        = context_runs_[table];
+            uint32_t &      position    = direct_[table * table_len + symbol * direct_len + code];
+
+            if(position == 0)
+            {
+                runs.push_back(RunType(symbol, code, 1));
+                position = uint32_t(runs.size());
+            }
+            else
+                ++runs[position - 1];
+        };
+
+        ScanContexts(block, block_len, [&](const ByteType & context, const ByteType & symbol, const SizeType & code, const SizeType &)
+        {
+            count(context_map_[context], symbol, code);
+            count(whole, symbol, code);
+
+            return true;
+        });
+
+        for(SizeType table = 0; table <= whole; ++table)
+            for(const auto & run : context_runs_[table])
+                direct_[table * table_len + run.symbol * direct_len + run.run_len] = 0;
+    }
+
+    SizeType bitstream_bits = 0;
+    SizeType whole_bits     = 0;
+    SizeType codeword_bits  = 0;    /**< Bits of the codewords of the tables of the contexts, with the limit and without */
+    SizeType optimal_bits   = 0;
+
+    {
+        PhaseTimer timer(stats_, &StatsType::create_tree_time);
+
+        for(SizeType table = 0; table <= whole; ++table)
+        {
+            runs_.swap(context_runs_[table]);
+
+            if(! runs_.empty())
+            {
+                CreateHuffmanTree();
+                AssignCodeword(root_, 0, 0);
+                DeleteHuffmanTree();
+
+                SizeType optimal;
+                SizeType bits = LimitCodewordLength(optimal);
+
+                /** The table changes from run to run; a lone run of a table still takes a bit.
+                    Coded as usual, a lone run of the whole block takes none.
+                */
+                if(runs_.size() == 1)
+                {
+                    runs_.front().codeword_len  = 1;
+                    bits                        = (table == whole) ? 0 : runs_.front().freq;
+                    optimal                     = bits;
+                }
+
+                if(table != whole)
+                {
+                    codeword_bits   += bits;
+                    optimal_bits    += optimal;
+                }
+
+                AssignCanonicalCodeword();
+
+                for(const auto & run : runs_)
+                    bits += (runs_.size() > 1 || table != whole) ? run.freq * LengthExtra(run.run_len) : 0;
+
+                (table == whole ? whole_bits : bitstream_bits) += bits;
+            }
+
+            runs_.swap(context_runs_[table]);
+        }
+    }
+
+    const   SizeType    start       = fout.Size();
+    const   SizeType    stored_size = VarintSize(block_len) + 1 + block_len;
+
+    BinaryStream::WriteVarint<SizeType>(fout, block_len);
+    BinaryStream::Write<ByteType>(fout, block_flags_);
+
+    {
+        PhaseTimer timer(stats_, &StatsType::header_time);
+
+        /** The tables, then the contexts that have a table other than the first, delta-coded, and the run table of each */
+        SizeType mapped = 0;
+        for(auto table : context_map_)
+            mapped += (table != 0);
+
+        BinaryStream::WriteVarint<SizeType>(fout, table_count);
+        BinaryStream::WriteVarint<SizeType>(fout, mapped);
+
+        SizeType last = 0;
+
+        for(SizeType context = 0; context < symbol_count; ++context)
+        {
+            if(context_map_[context] == 0)
+                continue;
+
+            BinaryStream::WriteVarint<SizeType>(fout, context - last);
+            BinaryStream::WriteVarint<SizeType>(fout, context_map_[context]);
+
+            last = context;
+        }
+    }
+
+    for(SizeType table = 0; table < table_count; ++table)
+    {
+        runs_.swap(context_runs_[table]);
+        WriteRunTable(fout);
+        runs_.swap(context_runs_[table]);
+    }
+
+    /** The run table of the whole block is written only to be measured */
+    SizeType whole_table_len;
+
+    {
+        const   SizeType    table_start = fout.Size();
+
+        runs_.swap(context_runs_[whole]);
+        WriteRunTable(fout);
+        runs_.swap(context_runs_[whole]);
+
+        whole_table_len = fout.Size() - table_start;
+        fout.Unreserve(whole_table_len);
+    }
+
+    SizeType bitstream_len  = (bitstream_bits + byte_size - 1) / byte_size;
+    SizeType whole_len      = (whole_bits + byte_size - 1) / byte_size;
+
+    const   SizeType    coded_size  = fout.Size() - start + VarintSize(bitstream_len) + bitstream_len;
+    const   SizeType    whole_size  = VarintSize(block_len) + 1 + whole_table_len + VarintSize(whole_len) + whole_len;
+
+    /** The estimate of the gains was off, and the tables cost more than they save against one table of the whole block;
+        the block is coded as usual, or stored
+    */
+    if(coded_size >= std::min(stored_size, whole_size))
+    {
+        fout.Unreserve(fout.Size() - start);
+        return false;
+    }
+
+    optimal_bits_ += optimal_bits;
+    encoded_bits_ += codeword_bits;
+
+    if(stats_ != nullptr)
+    {
+        stats_->optimal_codeword_bits += optimal_bits;
+
+        SizeType entries = 0;
+
+        for(SizeType table = 0; table < table_count; ++table)
+        {
+            entries += context_runs_[table].size();
+
+            for(const auto & run : context_runs_[table])
+            {
+                stats_->codeword_len_max    = std::max(stats_->codeword_len_max, run.codeword_len);
+                stats_->codeword_bits      += run.freq * run.codeword_len;
+                stats_->run_count          += run.freq;
+            }
+        }
+
+        stats_->meta_symbol_count = std::max(stats_->meta_symbol_count, entries);
+    }
+
+    PhaseTimer timer(stats_, &StatsType::encode_time);
+
+    context_encode_.resize(std::max(context_encode_.size(), table_count * table_len));
+
+    for(SizeType table = 0; table < table_count; ++table)
+        for(const auto & run : context_runs_[table])
+        {
+            EncodeEntryType & entry = context_encode_[table * table_len + run.symbol * direct_len + run.run_len];
+            entry.codeword      = run.codeword;
+            entry.codeword_len  = uint8_t(run.codeword_len);
+        }
+
+    BinaryStream::WriteVarint<SizeType>(fout, bitstream_len);
+
+    ByteType *  bitstream   = fout.Reserve(bitstream_len + BitWriter::slack);
+    BitWriter   writer(bitstream);
+
+    EncodeContexts(block, block_len, writer);
+    fout.Unreserve(BitWriter::slack);
+
+    /** Every slot is zero between blocks */
+    for(SizeType table = 0; table < table_count; ++table)
+        for(const auto & run : context_runs_[table])
+            context_encode_[table * table_len + run.symbol * direct_len + run.run_len] = EncodeEntryType();
+
+    return true;
+}
+
+bool
+Huffman
+::EncodeContexts(const ByteType * block, const SizeType & block_len, BitWriter & writer)
+{
+    const   SizeType    direct_len  = DirectLength(true);
+    const   SizeType    table_len   = (ascii_max + 1) * direct_len;
+
+    /** Codewords of the table of each context */
+    const EncodeEntryType * tables[ascii_max + 1];
+    for(SizeType context = 0; context <= ascii_max; ++context)
+        tables[context] = &context_encode_[context_map_[context] * table_len];
+
+    /** A copy on the stack, which the compiler can keep in registers */
+    BitWriter local(writer);
+
+    bool found = ScanContexts(block, block_len, [&](const ByteType & context, const ByteType & symbol, const SizeType & code, const SizeType & piece)
+    {
+        const EncodeEntryType & entry = tables[context][symbol * direct_len + code];
+
+        if(entry.codeword_len == 0)
+            return false;
+
+        /** The length code, then the offset from its base length */
+        local.Put(entry.codeword, entry.codeword_len);
+        local.Put(piece - LengthBase(code), LengthExtra(code));
+
+        return true;
+    });
+
+    writer = local;
+
+    return found;
+}
+
+bool
+Huffman
+::Decompress(StreamInType & fin, StreamOutType & fout)
+{
+    return DecompressStream(fin, fout, nullptr);
+}
+
+bool
+Huffman
+::Decompress(StreamInType & fin, StreamOutType & fout, const Codebook & codebook)
+{
+    return DecompressStream(fin, fout, &codebook);
+}
+
+bool
+Huffman
+::Decompress(const ByteType * in, const SizeType & in_len, ByteType * out, const SizeType & out_len)
+{
+    return DecompressMemory(in, in_len, out, out_len, nullptr);
+}
+
+bool
+Huffman
+::Decompress(const ByteType * in, const SizeType & in_len, ByteType * out, const SizeType & out_len, const Codebook & codebook)
+{
+    return DecompressMemory(in, in_len, out, out_len, &codebook);
+}
+
+bool
+Huffman
+::DecompressStream(StreamInType & fin, StreamOutType & fout, const Codebook * codebook)
+{
+    SizeType fout_size  = 0;
+    ByteType version    = legacy_version;
+
+    if(! ReadHeader(fin, version, fout_size))
+        return false;
+
+    if(version == legacy_version)
+    {
+        if(fout_size == 0)
+            return fout.good();
+
+        /** Rebuild the tree from the frequencies */
+        CreateHuffmanTree();
+        AssignCodeword(root_, 0, 0);
+        DeleteHuffmanTree();
+
+        CreateDecodeTable();
+        return Decode(fin, fout, fout_size) && fout.good();
+    }
+
+    if(version == unframed_version)
+    {
+        if(fout_size == 0)
+            return fout.good();
+
+        if(! ReadRunTable(fin))
+            return false;
+
+        AssignCanonicalCodeword();
+
+        CreateDecodeTable();
+        return Decode(fin, fout, fout_size) && fout.good();
+    }
+
+    if(version == framed_version || version == format_version)
+    {
+        IndexType index;
+
+        if(thread_count_ > 1 && ReadIndex(fin, index))
+            return DecompressBlocks(fin, fout, index, version);
+
+        std::vector<ByteType> bitstream;
+        std::vector<ByteType> block;
+
+        /** Block headers are served from chunks of fin */
+        BufferedReader reader(fin);
+
+        SizeType block_len = 0;
+        BinaryStream::ReadVarint<SizeType>(reader, block_len);
+
+        /** Blocks decoded, and their bytes, for the index to be checked against */
+        SizeType block_count    = 0;
+        SizeType raw_size       = 0;
+
+        while(reader.good() && block_len > 0)
+        {
+            ++block_count;
+            raw_size += block_len;
+
+            if(! ReadBlockFlags(reader, version))
+                return false;
+
+            if(block_flags_ & block_stored)
+            {
+                if(! ReadBytes(reader, block, block_len))
+                    return false;
+
+                fout.write((char *)block.data(), std::streamsize(block_len));
+
+                BinaryStream::ReadVarint<SizeType>(reader, block_len);
+                continue;
+            }
+
+            if(block_flags_ & block_contexts)
+            {
+                if(! ReadContextTables(reader, true))
+                    return false;
+            }
+            else
+            {
+                if(! ReadRunTable(reader))
+                    return false;
+
+                AssignCanonicalCodeword();
+            }
+
+            SizeType bitstream_len = 0;
+            BinaryStream::ReadVarint<SizeType>(reader, bitstream_len);
+
+            if(! ReadBytes(reader, bitstream, bitstream_len))
+                return false;
+
+            if(! (block_flags_ & block_contexts) && runs_.size() == 1)
+            {
+                /** Only one kind of run, and no bits; the block is written a chunk at a time, whatever its length says */
+                block.assign(std::min(block_len, chunk_size), runs_.front().symbol);
+
+                for(SizeType written = 0; written < block_len; written += block.size())
+                    fout.write((char *)block.data(), std::streamsize(std::min(block.size(), block_len - written)));
+
+                BinaryStream::ReadVarint<SizeType>(reader, block_len);
+                continue;
+            }
+
+            bool decoded = false;
+
+            if(block_flags_ & block_contexts)
+            {
+                bool fits = false;
+                for(const auto & table : context_tables_)
+                    fits = fits || MayDecodeTo(table, bitstream_len, block_len);
+
+                if(fits)
+                {
+                    block.resize(block_len);
+                    decoded = DecodeContexts(bitstream.data(), bitstream_len, block.data(), block_len);
+                }
+            }
+            else
+            {
+                CreateDecodeTable();
+
+                if(MayDecodeTo(table_, bitstream_len, block_len))
+                {
+                    block.resize(block_len);
+                    decoded = DecodeBlock(table_, block_flags_, bitstream.data(), bitstream_len, block.data(), block_len);
+                }
+            }
+
+            if(! decoded)
+                return false;
+
+            fout.write((char *)block.data(), std::streamsize(block_len));
+
+            BinaryStream::ReadVarint<SizeType>(reader, block_len);
+        }
+
+        /** A stream cut short has no block of no bytes at its end */
+        if(! reader.good() || ! fout.good())
+            return false;
+
+        if(version == framed_version)
+            return true;
+
+        /** The index follows, up to its footer; a stream cut within it, or with another index, is not whole */
+        SizeType index_len  = 0;
+        SizeType index_size = 0;
+        SizeType index_raw  = 0;
+
+        BinaryStream::ReadVarint<SizeType>(reader, index_len);
+        index_size += VarintSize(index_len);
+
+        for(SizeType i = 0; i < index_len && reader.good(); ++i)
+        {
+            SizeType size       = 0;
+            SizeType block_raw  = 0;
+
+            BinaryStream::ReadVarint<SizeType>(reader, size);
+            BinaryStream::ReadVarint<SizeType>(reader, block_raw);
+
+            index_size  += VarintSize(size) + VarintSize(block_raw);
+            index_raw   += block_raw;
+        }
+
+        uint64_t footer_size    = 0;
+        uint32_t signature      = 0;
+
+        BinaryStream::Read<uint64_t>(reader, footer_size);
+        BinaryStream::Read<uint32_t>(reader, signature);
+
+        return reader.good() && signature == index_magic && footer_size == index_size
+            && index_len == block_count && index_raw == raw_size;
+    }
+
+    if(version == codebook_version)
+    {
+        uint32_t id = 0;
+        BinaryStream::Read<uint32_t>(fin, id);
+
+        if(codebook == nullptr || codebook->empty() || codebook->id_ != id)
+            return false;
+
+        SizeType bitstream_len = 0;
+        BinaryStream::ReadVarint<SizeType>(fin, bitstream_len);
+
+        if(! fin.good() || ! ReadBytes(fin, block_in_, bitstream_len)
+        || ! MayDecodeTo(codebook->decode_table_, bitstream_len, fout_size))
+            return false;
+
+        block_out_->Clear();
+        ByteType * out = block_out_->Reserve(fout_size);
+
+        if(! DecodeBlock(codebook->decode_table_, codebook->flags_, block_in_.data(), bitstream_len, out, fout_size))
+            return false;
+
+        fout.write((char *)out, std::streamsize(fout_size));
+        return fout.good();
+    }
+
+    if(version == adaptive_version)
+        return DecodeAdaptive(fin, fout) && fout.good();
+
+    return false;
+}
+
+bool
+Huffman
+::DecompressMemory(const ByteType * in, const SizeType & in_len, ByteType * out, const SizeType & out_len, const Codebook * codebook)
+{
+    MemoryStreamBuffer  in_buffer(in, in_len);
+    std::istream        fin(&in_buffer);
+
+    SizeType fout_size  = 0;
+    ByteType version    = legacy_version;
+
+    if(! ReadHeader(fin, version, fout_size))
+        return false;
+
+    if(version == framed_version || version == format_version)
+    {
+        IndexType & index = index_;
+
+        /** Only the framed format was written without an index; the blocks of one are found by scanning them */
+        index.clear();
+        if(! ReadIndex(fin, index) && (version != framed_version || ! ScanIndex(fin, index, version)))
+            return false;
+
+        SizeType raw_size = index.empty() ? 0 : index.back().raw_offset + index.back().raw_size;
+        if(raw_size != out_len)
+            return false;
+
+        /** Each block is decoded straight from the input into its slice of the output */
+        if(thread_count_ <= 1)
+        {
+            for(const auto & entry : index)
+                if(! DecompressBlock(in + entry.offset, entry.size, out + entry.raw_offset, entry.raw_size, version))
+                    return false;
+
+            return true;
+        }
+
+        BoundedQueue<Huffman *>         idle(thread_count_);
+        LendWorkers(idle);
+
+        /** What the tasks write into outlives the pool, which runs the tasks left when this scope is left by an exception */
+        std::vector<StatsType>          block_stats(stats_ != nullptr ? index.size() : 0);
+
+        ThreadPool                      pool(thread_count_);
+        std::vector<std::future<bool> > decoded;
+
+        for(SizeType i = 0; i < index.size(); ++i)
+        {
+            const IndexEntryType &  entry   = index[i];
+            const ByteType *        block   = in + entry.offset;
+            ByteType *              slice   = out + entry.raw_offset;
+            StatsType *             stats   = stats_ != nullptr ? &block_stats[i] : nullptr;
+
+            decoded.push_back(pool.Submit([block, entry, slice, version, stats, &idle]
+            {
+                BorrowedCoder coder(idle);
+
+                coder->stats_ = stats;
+                return coder->DecompressBlock(block, entry.size, slice, entry.raw_size, version);
+            }));
+        }
+
+        bool whole = true;
+        for(auto & result : decoded)
+            whole = result.get() && whole;
+
+        if(stats_ != nullptr)
+            for(const auto & stats : block_stats)
+                *stats_ += stats;
+
+        return whole;
+    }
+
+    if(version == codebook_version)
+    {
+        uint32_t id = 0;
+        BinaryStream::Read<uint32_t>(fin, id);
+
+        SizeType bitstream_len = 0;
+        BinaryStream::ReadVarint<SizeType>(fin, bitstream_len);
+
+        if(codebook == nullptr || codebook->empty() || codebook->id_ != id)
+            return false;
+
+        SizeType pos = in_buffer.Position();
+
+        if(! fin.good() || bitstream_len > in_len - pos || fout_size != out_len)
+            return false;
+
+        return DecodeBlock(codebook->decode_table_, codebook->flags_, in + pos, bitstream_len, out, out_len);
+    }
+
+    if(version != legacy_version && version != unframed_version && version != adaptive_version)
+        return false;
+
+    /** The adaptive format is not sized up front; the output has to be filled exactly */
+    if(version != adaptive_version && fout_size != out_len)
+        return false;
+
+    /** The formats without blocks are decoded by the stream path, into the memory */
+    MemoryStreamBuffer  out_buffer(out, out_len);
+    std::ostream        fout(&out_buffer);
+
+    fin.clear();
+    fin.seekg(0, fin.beg);
+
+    return DecompressStream(fin, fout, codebook) && out_buffer.Written() == out_len;
+}
+
+bool
+Huffman
+::GetDecompressedSize(const ByteType * in, const SizeType & in_len, SizeType & size)
+{
+    MemoryStreamBuffer  in_buffer(in, in_len);
+    std::istream        fin(&in_buffer);
+
+    ByteType version = legacy_version;
+
+    if(! ReadHeader(fin, version, size))
+        return false;
+
+    /** The legacy header is checked against the size by ReadHeader, and the run table is checked here;
+        the bitstream of the codebook format fills the rest of the input exactly
+    */
+    if(version == legacy_version)
+        return in_len > 0;
+
+    if(version == unframed_version)
+        return size == 0 || ReadRunTable(fin);
+
+    if(version == codebook_version)
+    {
+        uint32_t id             = 0;
+        SizeType bitstream_len  = 0;
+
+        BinaryStream::Read<uint32_t>(fin, id);
+        BinaryStream::ReadVarint<SizeType>(fin, bitstream_len);
+
+        return fin.good() && bitstream_len == in_len - in_buffer.Position();
+    }
+
+    /** Known only by decoding the whole stream */
+    if(version == adaptive_version)
+        return false;
+
+    if(version != framed_version && version != format_version)
+        return false;
+
+    /** Only the framed format was written without an index */
+    IndexType index;
+    if(! ReadIndex(fin, index) && (version != framed_version || ! ScanIndex(fin, index, version)))
+        return false;
+
+    if(! index.empty())
+        size = index.back().raw_offset + index.back().raw_size;
+
+    return true;
+}
+
+bool
+Huffman
+::DecompressRange(StreamInType & fin, const SizeType & offset, const SizeType & length, StreamOutType & fout)
+{
+    const   bool        seekable    = fin.tellg() != std::streampos(-1);
+
+    SizeType fout_size  = 0;
+    ByteType version    = legacy_version;
+
+    if(seekable)
+    {
+        fin.clear();
+        fin.seekg(0, fin.beg);
+
+        if(! ReadHeader(fin, version, fout_size))
+            return false;
+
+        fin.clear();
+        fin.seekg(0, fin.beg);
+    }
+
+    /** A pipe cannot be seeked, and a format without blocks has no index; the stream is decoded
+        from where it is, and the bytes out of the range dropped
+    */
+    if(! seekable || (version != framed_version && version != format_version))
+    {
+        fin.clear();
+
+        RangeStreamBuffer   range_buffer(fout, offset, length);
+        std::ostream        range_out(&range_buffer);
+
+        return DecompressStream(fin, range_out, nullptr) && fout.good();
+    }
+
+    if(! ReadHeader(fin, version, fout_size))
+        return false;
+
+    /** Only the framed format was written without an index */
+    IndexType index;
+    if(! ReadIndex(fin, index) && (version != framed_version || ! ScanIndex(fin, index, version)))
+        return false;
+
+    if(index != block_cache_index_)
+    {
+        ClearBlockCache();
+        block_cache_index_ = index;
+    }
+
+    const   SizeType    end     = (length > std::numeric_limits<SizeType>::max() - offset)
+                                ? std::numeric_limits<SizeType>::max()
+                                : offset + length;
+
+    /** The first block ending after the offset */
+    auto block = std::upper_bound(index.begin(), index.end(), offset, [](const SizeType & pos, const IndexEntryType & entry)
+    { return pos < entry.raw_offset + entry.raw_size; });
+
+    for(; block != index.end() && block->raw_offset < end; ++block)
+    {
+        const BlockType *   bytes   = GetBlock(fin, index, SizeType(block - index.begin()), version);
+
+        if(bytes == nullptr)
+            return false;
+
+        SizeType            first   = std::max(offset, block->raw_offset) - block->raw_offset;
+        SizeType            last    = std::min(end, block->raw_offset + block->raw_size) - block->raw_offset;
+
+        fout.write((char *)bytes->data() + first, std::streamsize(last - first));
+    }
+
+    return fout.good();
+}
+
+Huffman
+::BlockType const *
+Huffman
+::GetBlock(StreamInType & fin, const IndexType & index, const SizeType & number, const ByteType & version)
+{
+    for(auto cached = block_cache_.begin(); cached != block_cache_.end(); ++cached)
+    {
+        if(cached->first == number)
+        {
+            /** Move to the front, as the most recently used */
+            block_cache_.splice(block_cache_.begin(), block_cache_, cached);
+            return &block_cache_.front().second;
+        }
+    }
+
+    const IndexEntryType & entry = index.at(number);
+
+    BlockType input(entry.size);
+    fin.clear();
+    fin.seekg(std::streamoff(entry.offset), fin.beg);
+    fin.read((char *)input.data(), std::streamsize(input.size()));
+
+    block_cache_.push_front(CachedBlockType(number, BlockType(entry.raw_size)));
+
+    /** A damaged block is not kept */
+    if(SizeType(fin.gcount()) != entry.size
+    || ! DecompressBlock(input.data(), entry.size, block_cache_.front().second.data(), entry.raw_size, version))
+    {
+        block_cache_.pop_front();
+        return nullptr;
+    }
+
+    /** The block just decoded is kept, even without room in the cache */
+    while(block_cache_.size() > std::max(SizeType(1), block_cache_size_))
+        block_cache_.pop_back();
+
+    return &block_cache_.front().second;
+}
+
+bool
+Huffman
+::DecompressBlocks(StreamInType & fin, StreamOutType & fout, const IndexType & index, const ByteType & version)
+{
+    BoundedQueue<Huffman *> idle(thread_count_);
+    LendWorkers(idle);
+
+    /** What the tasks write into outlives the pool, which runs the tasks left when this scope is left by an exception */
+    std::vector<ByteType>   input;
+    std::vector<ByteType>   output;
+    std::vector<StatsType>  block_stats;
+
+    ThreadPool              pool(thread_count_);
+
+    /** Blocks are decoded a window at a time, straight into their slices of the output */
+    const   SizeType        window_max = 2 * thread_count_;
+
+    if(! index.empty())
+        fin.seekg(std::streamoff(index.front().offset), fin.beg);
+
+    for(SizeType first = 0; first < index.size(); first += window_max)
+    {
+        SizeType last = std::min(first + window_max, index.size()) - 1;
+
+        const IndexEntryType & front    = index.at(first);
+        const IndexEntryType & back     = index.at(last);
+
+        input.resize(back.offset + back.size - front.offset);
+        fin.read((char *)input.data(), std::streamsize(input.size()));
+
+        if(SizeType(fin.gcount()) != input.size())
+            return false;
+
+        output.resize(back.raw_offset + back.raw_size - front.raw_offset);
+
+        std::vector<std::future<bool> > decoded;
+        block_stats.assign(stats_ != nullptr ? last + 1 - first : 0, StatsType());
+
+        for(SizeType i = first; i <= last; ++i)
+        {
+            const ByteType *    block       = input.data() + (index.at(i).offset - front.offset);
+            ByteType *          slice       = output.data() + (index.at(i).raw_offset - front.raw_offset);
+            const SizeType      block_size  = index.at(i).size;
+            const SizeType      slice_size  = index.at(i).raw_size;
+            StatsType *         stats       = stats_ != nullptr ? &block_stats[i - first] : nullptr;
+
+            decoded.push_back(pool.Submit([block, block_size, slice, slice_size, version, stats, &idle]
+            {
+                BorrowedCoder coder(idle);
+
+                coder->stats_ = stats;
+                return coder->DecompressBlock(block, block_size, slice, slice_size, version);
+            }));
+        }
+
+        bool whole = true;
+        for(auto & result : decoded)
+            whole = result.get() && whole;
+
+        if(stats_ != nullptr)
+            for(const auto & stats : block_stats)
+                *stats_ += stats;
+
+        if(! whole)
+            return false;
+
+        fout.write((char *)output.data(), std::streamsize(output.size()));
+    }
+
+    return fout.good();
+}
+
+bool
+Huffman
+::DecompressBlock(const ByteType * block, const SizeType & block_size, ByteType * out, const SizeType & out_len, const ByteType & version)
+{
+    BufferedReader fin(block, block_size);
+
+    SizeType block_len = 0;
+    BinaryStream::ReadVarint<SizeType>(fin, block_len);
+
+    if(! fin.good() || block_len != out_len || ! ReadBlockFlags(fin, version))
+        return false;
+
+    if(block_flags_ & block_stored)
+    {
+        SizeType pos = fin.Position();
+
+        if(block_size - pos != block_len)
+            return false;
+
+        std::memcpy(out, block + pos, block_len);
+        return true;
+    }
+
+    if(block_flags_ & block_contexts)
+    {
+        if(! ReadContextTables(fin, true))
+            return false;
+    }
+    else
+    {
+        if(! ReadRunTable(fin))
+            return false;
+
+        AssignCanonicalCodeword();
+    }
+
+    SizeType bitstream_len = 0;
+    BinaryStream::ReadVarint<SizeType>(fin, bitstream_len);
+
+    SizeType pos = fin.Position();
+
+    if(! fin.good() || block_size - pos != bitstream_len)
+        return false;
+
+    if(block_flags_ & block_contexts)
+        return DecodeContexts(block + pos, bitstream_len, out, out_len);
+
+    CreateDecodeTable();
+    return DecodeBlock(table_, block_flags_, block + pos, bitstream_len, out, out_len);
+}
+
+Huffman
+::SizeType
+Huffman
+::CollectRuns(const ByteType * block, const SizeType & block_len, const SizeType & stride)
+{
+    const   bool                                    bucketed    = (block_flags_ & block_bucketed) != 0;
+
+    /** Position of each run in runs_, plus one; zero for a run not seen yet.
+        Short runs, and every length code, are looked up in a flat table of
+        (symbol, run_len); the few long runs in a hash table keyed by both
+    */
+    const   SizeType                                direct_len  = DirectLength(bucketed);
+
+    /** Both tables are kept by the coder; every slot is zero between blocks */
+    std::vector<uint32_t> &                         direct      = direct_;
+    std::unordered_map<uint64_t, uint32_t> &        hashed      = hashed_;
+
+    direct.resize((ascii_max + 1) * (length_code_max + 1), 0);
+
+    auto count = [&](const ByteType & symbol, const SizeType & run_len)
+    {
+        uint32_t * position;
+
+        if(run_len < direct_len)
+            position = &direct[symbol * direct_len + run_len];
+        else
+            position = &hashed[(uint64_t(run_len) << byte_size) | symbol];
+
+        if(*position == 0)
+        {
+            runs_.push_back(RunType(symbol, run_len, 1));       /** First appreance; freq is 1 */
+            *position = uint32_t(runs_.size());                 /** Cache the position */
+        }
+        else
+            ++runs_[*position - 1];                             /** Add freq */
+    };
+
+    auto collect = [&](const ByteType & symbol, const SizeType & run_len)
+    {
+        if(! bucketed && run_len <= run_len_max)
+            count(symbol, run_len);
+        else if(! bucketed)
+        {
+            /** Runs longer than a decode entry holds are split; only a block beyond 4 GiB has them */
+            for(SizeType rest = run_len; rest > 0; rest -= std::min(rest, run_len_max))
+                count(symbol, std::min(rest, run_len_max));
+        }
+        else
+        {
+            /** Runs beyond the last length code are split */
+            for(SizeType rest = run_len; rest > 0; rest -= std::min(rest, length_run_max))
+                count(symbol, LengthCode(std::min(rest, length_run_max)));
+        }
+
+        return true;
+    };
+
+    /** The first chunk of each stride, or the whole block */
+    SizeType counted_len = block_len;
+
+    if(stride <= 1)
+        RunScanner::Scan(block, block_len, collect);
+    else
+    {
+        counted_len = 0;
+
+        for(SizeType pos = 0; pos < block_len; pos += stride * sample_chunk)
+        {
+            SizeType len = std::min(sample_chunk, block_len - pos);
+
+            RunScanner::Scan(block + pos, len, collect);
+            counted_len += len;
+        }
+    }
+
+    for(const auto & run : runs_)
+        if(run.run_len < direct_len)
+            direct[run.symbol * direct_len + run.run_len] = 0;
+
+    hashed.clear();
+
+    return counted_len;
+}
+
+void
+Huffman
+::CreateHuffmanTree(void)
+{
+    /** Leaves point back to their runs, so that AssignCodeword writes the codewords into runs_ */
+    Heap<RunType>   heap;
+    heap.swap(heap_);
+    heap.clear();
+
+    for(auto & run : runs_)
+    {
+        RunType leaf(run);
+        leaf.next = &run;
+
+        heap.Push(leaf);
+    }
+
+    /** Every node is taken from nodes_, which is not reallocated while the tree is alive;
+        it grows by doubling, so that a coder of many messages stops allocating
+    */
+    nodes_.clear();
+    if(2 * runs_.size() > nodes_.capacity())
+        nodes_.reserve(std::max(2 * runs_.size(), 2 * nodes_.capacity()));
+
+    while(heap.size() > 1)
+    {
+        nodes_.push_back(heap.Peek());
+        RunType * left  = &nodes_.back();
+        heap.Pop();
+
+        nodes_.push_back(heap.Peek());
+        RunType * right = &nodes_.back();
+        heap.Pop();
+
+        RunType temp(left, right);
+        heap.Push(temp);
+    }
+
+    nodes_.push_back(heap.Peek());
+    root_ = &nodes_.back();
+    heap.Pop();
+
+    heap.swap(heap_);
+}
+
+void
+Huffman
+::DeleteHuffmanTree(void)
+{
+    /** The nodes go at once; their memory is kept for the next tree */
+    nodes_.clear();
+    root_ = nullptr;
+}
+
+void
+Huffman
+::CreateEncodeTable(void)
+{
+    /** Short runs are found at once in encode_table_; the rare long ones through list_ */
+    const   SizeType    direct_len  = DirectLength((block_flags_ & block_bucketed) != 0);
+
+    encode_table_.resize((ascii_max + 1) * (length_code_max + 1));
+    list_.fill(nullptr);
+
+    for(auto & run : runs_)
+    {
+        if(run.run_len < direct_len)
+        {
+            EncodeEntryType & entry = encode_table_[run.symbol * direct_len + run.run_len];
+            entry.codeword      = run.codeword;
+            entry.codeword_len  = uint8_t(run.codeword_len);
+        }
+        else
+        {
+            run.next = list_.at(run.symbol);
+            list_.at(run.symbol) = &run;
+        }
+    }
+}
+void
+Huffman
+::AssignCodeword(RunType * node, const CodewordType & codeword, const SizeType & codeword_len)
+{
+    if(node->left == nullptr && node->right == nullptr)
+    {
+        node->next->codeword        = codeword;
+        node->next->codeword_len    = codeword_len;
+    }
+    else
+    {
+        AssignCodeword(node->left,  (codeword << 1) + 0, codeword_len + 1);
+        AssignCodeword(node->right, (codeword << 1) + 1, codeword_len + 1);
+    }
+}
+
+Huffman
+::SizeType
+Huffman
+::LimitCodewordLength(SizeType & optimal_bits)
+{
+    SizeType longest        = 0;
+
+    optimal_bits = 0;
+
+    for(auto run : runs_)
+    {
+        optimal_bits += run.freq * run.codeword_len;
+        longest = std::max(longest, run.codeword_len);
+    }
+
+    if(longest <= codeword_len_limit_)
+        return optimal_bits;
+
+    /** Package-merge;
+        The coins of each denomination are the runs, merged with the packages
+        of the coins one denomination below. The cheapest 2n - 2 coins at the top
+        give the optimal codeword lengths not longer than the limit.
+    */
+    struct Coin
+    {
+        SizeType    weight;
+        SizeType    run;        /**< Index of the run, for a leaf coin */
+        SizeType    left;       /**< Coins of the package, for a package coin */
+        SizeType    right;
+    };
+
+    const   SizeType    none = std::numeric_limits<SizeType>::max();
+
+    SizeType limit = codeword_len_limit_;
+    while((SizeType(0x1) << limit) < runs_.size())
+        ++limit;
+
+    std::vector<SizeType> order(runs_.size());
+    for(SizeType i = 0; i < order.size(); ++i)
+        order.at(i) = i;
+
+    std::sort(order.begin(), order.end(), [this](const SizeType & lhs, const SizeType & rhs)
+    { return runs_.at(lhs).freq < runs_.at(rhs).freq; });
+
+    std::vector<Coin>       coins;
+    std::vector<SizeType>   list;       /**< Coins of the current denomination, by weight */
+
+    for(SizeType depth = 0; depth < limit; ++depth)
+    {
+        std::vector<SizeType> merged;
+        merged.reserve(order.size() + list.size() / 2);
+
+        SizeType leaf = 0;
+        SizeType pair = 0;
+
+        while(leaf < order.size() || pair + 1 < list.size())
+        {
+            SizeType package_weight = (pair + 1 < list.size())
+                                    ? coins.at(list.at(pair)).weight + coins.at(list.at(pair + 1)).weight
+                                    : none;
+
+            if(leaf < order.size() && runs_.at(order.at(leaf)).freq <= package_weight)
+            {
+                Coin coin = { runs_.at(order.at(leaf)).freq, order.at(leaf), none, none };
+                coins.push_back(coin);
+                ++leaf;
+            }
+            else
+            {
+                Coin coin = { package_weight, none, list.at(pair), list.at(pair + 1) };
+                coins.push_back(coin);
+                pair += 2;
+            }
+
+            merged.push_back(coins.size() - 1);
+        }
+
+        list.swap(merged);
+    }
+
+    /** Each appearance of a run in the chosen coins adds a bit to its codeword */
+    for(auto & run : runs_)
+        run.codeword_len = 0;
+
+    std::vector<SizeType> stack(list);
+    stack.resize(2 * runs_.size() - 2);
+
+    while(! stack.empty())
+    {
+        const Coin & coin = coins.at(stack.back());
+        stack.pop_back();
+
+        if(coin.run != none)
+            ++runs_.at(coin.run).codeword_len;
+        else
+        {
+            stack.push_back(coin.left);
+            stack.push_back(coin.right);
+        }
+    }
+
+    SizeType encoded_bits = 0;
+    for(auto run : runs_)
+        encoded_bits += run.freq * run.codeword_len;
+
+    return encoded_bits;
+}
+
+void
+Huffman
+::AssignCanonicalCodeword(void)
+{
+    /** Only the codeword lengths are kept;
+        codewords of the same length are consecutive, in order of the meta symbol
+    */
+    std::sort(runs_.begin(), runs_.end(), [](const RunType & lhs, const RunType & rhs)
+    {
+        return std::make_tuple(lhs.codeword_len, lhs.symbol, lhs.run_len)
+             < std::make_tuple(rhs.codeword_len, rhs.symbol, rhs.run_len);
+    });
+
+    CodewordType    codeword        = 0;
+    SizeType        codeword_len    = 0;
+
+    for(auto & run : runs_)
+    {
+        codeword    <<= (run.codeword_len - codeword_len);
+        codeword_len  = run.codeword_len;
+
+        run.codeword = codeword++;
+    }
+
+    /** The header lists the runs in order of the meta symbol */
+    std::sort(runs_.begin(), runs_.end(), [](const RunType & lhs, const RunType & rhs)
+    { return std::make_pair(lhs.symbol, lhs.run_len) < std::make_pair(rhs.symbol, rhs.run_len); });
+}
+
+Huffman
+::SizeType
+Huffman
+::GetCodeword(CodewordType & codeword, const ByteType & symbol, const SizeType & run_len)
+{
+    RunType * n = list_.at(symbol);
+    for(; n != nullptr && n->run_len != run_len; n = n->next);
+
+    if(n == nullptr)
+        return 0;
+    else
+    {
+        codeword = n->codeword;
+        return n->codeword_len;
+    }
+}
+
+void
+Huffman
+::CreateDecodeTable(void)
+{
+    leaves_.clear();
+    for(auto & run : runs_)
+        leaves_.push_back(&run);
+
+    table_.assign(SizeType(0x1) << lookup_bits, DecodeEntryType());
+    FillDecodeTable(0, lookup_bits, 0, leaves_);
+}
+
+void
+Huffman
+::FillDecodeTable(const SizeType & offset, const SizeType & width, const SizeType & prefix_len, const std::vector<RunType *> & leaves)
+{
+    typedef     std::map<SizeType, std::vector<RunType *> >  GroupType;
+
+    GroupType   groups;         /**< Longer codewords, grouped by their index in this table */
+
+    for(auto leaf : leaves)
+    {
+        SizeType    rest    = leaf->codeword_len - prefix_len;
+        uint64_t    suffix  = uint64_t(leaf->codeword) & ((uint64_t(0x1) << rest) - 1);
+
+        if(rest <= width)
+        {
+            /** Every index starting with the codeword resolves to this leaf */
+            DecodeEntryType entry;
+            entry.value     = uint32_t(leaf->run_len);
+            entry.symbol    = leaf->symbol;
+            entry.bits      = uint8_t(rest);
+
+            if((block_flags_ & block_sampled) && leaf->run_len == sample_escape)
+            {
+                /** No base length; the extra bits are the symbol and the length code of the run */
+                entry.value = 0;
+                entry.extra = uint8_t(byte_size + adaptive_escape_bits);
+            }
+            else if(block_flags_ & block_bucketed)
+            {
+                entry.value = uint32_t(LengthBase(leaf->run_len));
+                entry.extra = uint8_t(LengthExtra(leaf->run_len));
+            }
+
+            SizeType first  = SizeType(suffix << (width - rest));
+            SizeType last   = first + (SizeType(0x1) << (width - rest));
+
+            for(SizeType i = first; i < last; ++i)
+                table_.at(offset + i) = entry;
+        }
+        else
+            groups[SizeType(suffix >> (rest - width))].push_back(leaf);
+    }
+
+    for(auto group : groups)
+    {
+        SizeType max_rest = 0;
+        for(auto leaf : group.second)
+            max_rest = std::max(max_rest, leaf->codeword_len - prefix_len - width);
+
+        SizeType sub_width  = std::min(max_rest, lookup_bits);
+        SizeType sub_offset = table_.size();
+        table_.resize(sub_offset + (SizeType(0x1) << sub_width));
+
+        DecodeEntryType & entry = table_.at(offset + group.first);
+        entry.value     = uint32_t(sub_offset);
+        entry.bits      = uint8_t(width);
+        entry.sub_bits  = uint8_t(sub_width);
+
+        FillDecodeTable(sub_offset, sub_width, prefix_len + width, group.second);
+    }
+}
+
+void
+Huffman
+::WriteHeader(BufferedWriter & fout)
+{
+    BinaryStream::Write<uint32_t>(fout, magic | format_version);
+}
+
+void
+Huffman
+::WriteRunTable(BufferedWriter & fout)
+{
+    PhaseTimer timer(stats_, &StatsType::header_time);
+
+    BinaryStream::WriteVarint<SizeType>(fout, runs_.size());
+
+    /** (symbol, run_len, codeword_len) in order of the meta symbol;
+        symbol and run_len are delta-coded against the previous run
+    */
+    ByteType symbol  = 0;
+    SizeType run_len = 0;
+
+    for(auto run : runs_)
+    {
+        if(run.symbol != symbol)
+            run_len = 0;
+
+        BinaryStream::WriteVarint<ByteType>(fout, run.symbol - symbol);
+        BinaryStream::WriteVarint<SizeType>(fout, run.run_len - run_len - 1);
+        BinaryStream::Write<ByteType>(fout, ByteType(run.codeword_len));
+
+        symbol  = run.symbol;
+        run_len = run.run_len;
+    }
+}
+
+bool
+Huffman::
+ReadHeader(StreamInType & fin, ByteType & version, SizeType & fout_size)
+{
+    runs_.clear();
+    block_flags_    = 0;
+    version         = legacy_version;
+    fout_size       = 0;
+
+    uint32_t signature = 0;
+    BinaryStream::Read<uint32_t>(fin, signature);
+
+    /** An empty input is an empty stream; a shorter one than the signature, a truncated one */
+    if(! fin.good())
+        return fin.gcount() == 0;
+
+    if((signature & ~uint32_t(ascii_max)) != magic)
+    {
+        /** Legacy header;
+            uint16_t run_size, uint32_t fout_size,
+            and (symbol, run_len, freq) of each run
+        */
+        uint16_t run_size = uint16_t(signature >> 16);
+
+        uint16_t fout_size_low = 0;
+        BinaryStream::Read<uint16_t>(fin, fout_size_low);
+
+        fout_size = SizeType(((signature & 0xffff) << 16) | fout_size_low);
+
+        /** Without a signature, only a header whose runs add up to the size is taken for one;
+            the legacy encoder counted a byte of 0 past the end of its input
+        */
+        SizeType total = 0;
+
+        for(int i = 0; i < run_size && fin.good(); ++i)
+        {
+            ByteType symbol = 0;
+            BinaryStream::Read<ByteType>(fin, symbol);
+
+            SizeType run_len = 0;
+            BinaryStream::Read<SizeType>(fin, run_len);
+
+            SizeType freq = 0;
+            BinaryStream::Read<SizeType>(fin, freq);
+
+            if(run_len == 0 || freq == 0 || run_len > fout_size + 1 || freq > (fout_size + 1 - total) / run_len)
+                return false;
+
+            total += freq * run_len;
+
+            Run temp = Run(symbol, run_len, freq);
+            runs_.push_back(temp);
+        }
+
+        return fin.good() && (total == fout_size || total == fout_size + 1);
+    }
+
+    version = ByteType(signature & ascii_max);
+
+    if(version > adaptive_version)
+        return false;
+
+    /** The unframed format, and the codebook one, put the size of the whole output up front */
+    if(version == unframed_version || version == codebook_version)
+        BinaryStream::ReadVarint<SizeType>(fin, fout_size);
+
+    return fin.good();
+}
+
+template<typename STREAM_IN>
+bool
+Huffman
+::ReadBlockFlags(STREAM_IN & fin, const ByteType & version)
+{
+    /** The blocks of the framed format have no flags */
+    block_flags_ = 0;
+
+    if(version == framed_version)
+        return true;
+
+    BinaryStream::Read<ByteType>(fin, block_flags_);
+
+    /** Flags the encoder sets together; stored and contexts blocks have no others, and sampled ones are bucketed */
+    const   ByteType    coded   = block_bucketed | block_interleaved | block_sampled;
+
+    if(block_flags_ == block_stored || block_flags_ == (block_bucketed | block_contexts))
+        return fin.good();
+
+    return fin.good() && (block_flags_ & ~coded) == 0
+        && (! (block_flags_ & block_sampled) || (block_flags_ & block_bucketed));
+}
+
+template<typename STREAM_IN>
+bool
+Huffman
+::ReadRunTable(STREAM_IN & fin)
+{
+    PhaseTimer timer(stats_, &StatsType::header_time);
+
+    runs_.clear();
+
+    SizeType run_size = 0;
+    BinaryStream::ReadVarint<SizeType>(fin, run_size);
+
+    /** Longest run of the table; the length codes of bucketed blocks, and the escape of sampled ones */
+    const   SizeType    run_len_limit   = (block_flags_ & block_sampled) ? sample_escape
+                                        : (block_flags_ & block_bucketed) ? length_code_max
+                                        : run_len_max;
+
+    SizeType symbol  = 0;
+    SizeType run_len = 0;
+    uint64_t kraft   = 0;
+
+    for(SizeType i = 0; i < run_size && fin.good(); ++i)
+    {
+        SizeType symbol_delta = 0;
+        BinaryStream::ReadVarint<SizeType>(fin, symbol_delta);
+
+        SizeType run_len_delta = 0;
+        BinaryStream::ReadVarint<SizeType>(fin, run_len_delta);
+
+        ByteType codeword_len = 0;
+        BinaryStream::Read<ByteType>(fin, codeword_len);
+
+        if(symbol_delta != 0)
+            run_len = 0;
+
+        /** Runs are in order of the meta symbol, and their codewords a prefix code; a lone run has no codeword */
+        if(symbol_delta > ascii_max - symbol || run_len_delta >= run_len_limit - run_len
+        || codeword_len > codeword_len_max || (codeword_len == 0 && run_size != 1))
+            return false;
+
+        symbol  += symbol_delta;
+        run_len += run_len_delta + 1;
+
+        if(codeword_len != 0)
+            kraft += uint64_t(0x1) << (codeword_len_max - codeword_len);
+
+        if(kraft > (uint64_t(0x1) << codeword_len_max))
+            return false;
+
+        Run temp = Run(ByteType(symbol), run_len);
+        temp.codeword_len = codeword_len;
+        runs_.push_back(temp);
+    }
+
+    return fin.good();
+}
+
+template<typename STREAM_IN>
+bool
+Huffman
+::ReadContextTables(STREAM_IN & fin, const bool & decode)
+{
+    SizeType table_count    = 0;
+    SizeType mapped         = 0;
+
+    BinaryStream::ReadVarint<SizeType>(fin, table_count);
+    BinaryStream::ReadVarint<SizeType>(fin, mapped);
+
+    if(! fin.good() || table_count == 0 || table_count > context_table_max || mapped > ascii_max + 1)
+        return false;
+
+    /** Contexts not listed have the first table */
+    context_map_.fill(0);
+
+    SizeType context = 0;
+
+    for(SizeType i = 0; i < mapped; ++i)
+    {
+        SizeType context_delta  = 0;
+        SizeType table          = 0;
+
+        BinaryStream::ReadVarint<SizeType>(fin, context_delta);
+        BinaryStream::ReadVarint<SizeType>(fin, table);
+
+        context += context_delta;
+
+        if(! fin.good() || context > ascii_max || table >= table_count)
+            return false;
+
+        context_map_[context] = ByteType(table);
+    }
+
+    /** Without `decode' the run tables are only skipped */
+    if(context_tables_.size() < table_count)
+        context_tables_.resize(table_count);
+
+    for(SizeType table = 0; table < table_count; ++table)
+    {
+        if(! ReadRunTable(fin))
+            return false;
+
+        if(decode)
+        {
+            AssignCanonicalCodeword();
+            CreateDecodeTable();
+            context_tables_[table].swap(table_);
+        }
+    }
+
+    return fin.good();
+}
+
+void
+Huffman
+::WriteIndex(BufferedWriter & fout, const IndexType & index)
+{
+    /** Sizes of each block, compressed and uncompressed; the offsets are their sums */
+    BufferedWriter & index_out = *block_out_;
+    index_out.Clear();
+
+    BinaryStream::WriteVarint<SizeType>(index_out, index.size());
+
+    for(auto entry : index)
+    {
+        BinaryStream::WriteVarint<SizeType>(index_out, entry.size);
+        BinaryStream::WriteVarint<SizeType>(index_out, entry.raw_size);
+    }
+
+    fout.write((char *)index_out.Data(), std::streamsize(index_out.Size()));
+
+    /** Fixed-size footer, so that the index is found from the end of the stream */
+    BinaryStream::Write<uint64_t>(fout, index_out.Size());
+    BinaryStream::Write<uint32_t>(fout, index_magic);
+}
+
+bool
+Huffman
+::ReadIndex(StreamInType & fin, IndexType & index)
+{
+    /** The first block starts at the current position */
+    std::streampos start = fin.tellg();
+    if(start == std::streampos(-1))
+        return false;
+
+    uint64_t index_size = 0;
+    uint32_t signature  = 0;
+
+    fin.seekg(-std::streamoff(index_footer_size), fin.end);
+    BinaryStream::Read<uint64_t>(fin, index_size);
+    BinaryStream::Read<uint32_t>(fin, signature);
+
+    bool found = fin.good() && signature == index_magic;
+
+    if(found)
+    {
+        fin.seekg(-std::streamoff(index_footer_size + index_size), fin.end);
+        std::streampos index_pos = fin.tellg();
+
+        SizeType index_len = 0;
+        BinaryStream::ReadVarint<SizeType>(fin, index_len);
+
+        SizeType offset     = SizeType(start);
+        SizeType raw_offset = 0;
+
+        for(SizeType i = 0; i < index_len && fin.good(); ++i)
+        {
+            IndexEntryType entry = { offset, 0, raw_offset, 0 };
+            BinaryStream::ReadVarint<SizeType>(fin, entry.size);
+            BinaryStream::ReadVarint<SizeType>(fin, entry.raw_size);
+
+            index.push_back(entry);
+
+            offset      += entry.size;
+            raw_offset  += entry.raw_size;
+        }
+
+        /** The blocks, and a byte of end of stream, fill the space up to the index */
+        found = fin.good() && index_pos != std::streampos(-1) && offset + 1 == SizeType(index_pos);
+    }
+
+    if(! found)
+        index.clear();
+
+    fin.clear();
+    fin.seekg(start);
+
+    return found;
+}
+
+bool
+Huffman
+::ScanIndex(StreamInType & fin, IndexType & index, const ByteType & version)
+{
+    /** Without an index, the blocks are found by skipping over their bitstreams, or their stored bytes */
+    std::streampos start = fin.tellg();
+    if(start == std::streampos(-1))
+        return false;
+
+    SizeType offset     = SizeType(start);
+    SizeType raw_offset = 0;
+
+    SizeType block_len;
+    BinaryStream::ReadVarint<SizeType>(fin, block_len);
+
+    while(fin.good() && block_len > 0)
+    {
+        if(! ReadBlockFlags(fin, version))
+            break;
+
+        SizeType bitstream_len = block_len;
+
+        if(block_flags_ & block_contexts)
+        {
+            if(! ReadContextTables(fin, false))
+                break;
+
+            BinaryStream::ReadVarint<SizeType>(fin, bitstream_len);
+        }
+        else if(! (block_flags_ & block_stored))
+        {
+            if(! ReadRunTable(fin))
+                break;
+
+            BinaryStream::ReadVarint<SizeType>(fin, bitstream_len);
+        }
+
+        fin.seekg(std::streamoff(bitstream_len), fin.cur);
+
+        std::streampos next = fin.tellg();
+        if(! fin.good() || next == std::streampos(-1))
+            break;
+
+        IndexEntryType entry = { offset, SizeType(next) - offset, raw_offset, block_len };
+        index.push_back(entry);
+
+        offset      += entry.size;
+        raw_offset  += entry.raw_size;
+
+        BinaryStream::ReadVarint<SizeType>(fin, block_len);
+    }
+
+    bool found = fin.good() && block_len == 0;
+
+    if(! found)
+        index.clear();
+
+    fin.clear();
+    fin.seekg(start);
+
+    return found;
+}
+
+template<Huffman::SizeType STREAMS>
+bool
+Huffman
+::Encode(const EncodeTableType & table, const ByteType & flags, const ByteType * block, const SizeType & block_len, BitWriter * writers, SizeType & next)
+{
+    /** Each writer has room for the whole bitstream, and BitWriter::slack bytes after it;
+        the codewords, with their extra bits, are dealt to the STREAMS writers in turn,
+        from writer `next', which is left at the one after the last
+    */
+    const   bool            bucketed        = (flags & block_bucketed) != 0;
+    const   SizeType        direct_len      = DirectLength(bucketed);
+
+    /** Copies on the stack, which the compiler can keep in registers */
+    BitWriter               local[STREAMS];
+    std::copy(writers, writers + STREAMS, local);
+
+    BitWriter *             writer          = &local[0];
+    SizeType                turn            = next;
+
+    /** The runs missing from the code of a sampled block follow its escape, as a symbol and a length code */
+    CodewordType            escape          = 0;
+    SizeType                escape_len      = 0;
+
+    if(flags & block_sampled)
+        escape_len = GetCodeword(escape, 0, sample_escape);
+
+    auto put = [&](const ByteType & symbol, const SizeType & run_len)
+    {
+        CodewordType    codeword;
+        SizeType        codeword_len;
+
+        if(run_len < direct_len)
+        {
+            const EncodeEntryType & entry = table[symbol * direct_len + run_len];
+
+            codeword        = entry.codeword;
+            codeword_len    = entry.codeword_len;
+        }
+        else
+            codeword_len    = GetCodeword(codeword, symbol, run_len);
+
+        if(codeword_len == 0)
+        {
+            if(escape_len == 0)
+                return false;
+
+            writer = &local[turn++ % STREAMS];
+            writer->Put(escape, escape_len);
+            writer->Put((SizeType(symbol) << adaptive_escape_bits) | run_len, byte_size + adaptive_escape_bits);
+            return true;
+        }
+
+        writer = &local[turn++ % STREAMS];
+        writer->Put(codeword, codeword_len);
+        return true;
+    };
+
+    bool found = RunScanner::Scan(block, block_len, [&](const ByteType & symbol, const SizeType & run_len)
+    {
+        /** Write the codeword to its writer */
+
+        if(! bucketed && run_len <= run_len_max)
+            return put(symbol, run_len);
+
+        if(! bucketed)
+        {
+            /** Split as CollectRuns does */
+            for(SizeType rest = run_len; rest > 0; rest -= std::min(rest, run_len_max))
+                if(! put(symbol, std::min(rest, run_len_max)))
+                    return false;
+
+            return true;
+        }
+
+        /** The length code, then the offset from its base length */
+        for(SizeType rest = run_len; rest > 0;)
+        {
+            SizeType piece  = std::min(rest, length_run_max);
+            SizeType code   = LengthCode(piece);
+
+            if(! put(symbol, code))
+                return false;
+
+            writer->Put(piece - LengthBase(code), LengthExtra(code));
+
+            rest -= piece;
+        }
+
+        return true;
+    });
+
+    std::copy(local, local + STREAMS, writers);
+    next = turn % STREAMS;
+
+    return found;
+}
+
+bool
+Huffman::
+Decode(StreamInType & fin, StreamOutType & fout, const SizeType & fout_size)
+{
+    PhaseTimer          timer(stats_, &StatsType::decode_time);
+
+    std::vector<char>   buffer(chunk_size);
+    SizeType            buffer_len  = 0;
+    SizeType            written     = 0;
+
+    if(runs_.size() == 1)
+    {
+        /** Only one kind of run; the encoder emitted no bits at all */
+        std::memset(&buffer[0], runs_.front().symbol, buffer.size());
+
+        for(; written < fout_size; written += buffer_len)
+        {
+            buffer_len = std::min(buffer.size(), fout_size - written);
+            fout.write(&buffer[0], buffer_len);
+        }
+
+        return true;
+    }
+
+    BitReader           reader(fin);
+
+    while(written < fout_size)
+    {
+        const DecodeEntryType & entry = ReadCodeword(table_, reader);
+
+        /** Only the zero bits stripped from the last codeword buffer may be read past the end */
+        if(entry.bits == 0 || reader.Overrun() > buffer_size)
+            return false;
+
+        SizeType run_len = std::min(SizeType(entry.value), fout_size - written);
+        written += run_len;
+
+        while(run_len > 0)
+        {
+            SizeType len = std::min(run_len, buffer.size() - buffer_len);
+            std::memset(&buffer[buffer_len], entry.symbol, len);
+
+            buffer_len  += len;
+            run_len     -= len;
+
+            if(buffer_len == buffer.size())
+            {
+                fout.write(&buffer[0], buffer_len);
+                buffer_len = 0;
+            }
+        }
+    }
+
+    fout.write(&buffer[0], buffer_len);
+    return true;
+}
+
+bool
+Huffman
+::DecodeBlock(const DecodeTableType & table, const ByteType & flags, const ByteType * bitstream, const SizeType & bitstream_len, ByteType * out, const SizeType & out_len)
+{
+    PhaseTimer timer(stats_, &StatsType::decode_time);
+
+    if(runs_.size() == 1)
+    {
+        /** Only one kind of run; the encoder emitted no bits at all */
+        std::memset(out, runs_.front().symbol, out_len);
+        return true;
+    }
+
+    if(flags & block_interleaved)
+        return DecodeInterleaved(table, bitstream, bitstream_len, out, out_len);
+
+    BitReader reader(bitstream, bitstream_len);
+
+    for(SizeType written = 0; written < out_len;)
+    {
+        const DecodeEntryType & entry = ReadCodeword(table, reader);
+
+        SizeType run_len = entry.value;
+        ByteType symbol  = entry.symbol;
+
+        if(entry.extra != 0)
+        {
+            run_len += SizeType(reader.Peek(entry.extra));
+            reader.Skip(entry.extra);
+
+            /** The escape of a sampled block has no base length */
+            if(entry.value == 0 && ! ReadEscaped(reader, run_len, symbol, run_len))
+                return false;
+        }
+
+        if(entry.bits == 0 || reader.Overrun() > 0)
+            return false;
+
+        run_len = std::min(run_len, out_len - written);
+
+        FillRun(out + written, symbol, run_len, out_len - written);
+        written += run_len;
+    }
+
+    return true;
+}
+
+bool
+Huffman
+::DecodeInterleaved(const DecodeTableType & table, const ByteType * bitstream, const SizeType & bitstream_len, ByteType * out, const SizeType & out_len)
+{
+    /** The sizes of the bitstreams but the last lead them */
+    BufferedReader header(bitstream, bitstream_len);
+
+    SizeType sizes[interleave_count];
+    for(SizeType i = 0; i + 1 < interleave_count; ++i)
+        BinaryStream::ReadVarint<SizeType>(header, sizes[i]);
+
+    if(! header.good())
+        return false;
+
+    const ByteType *    starts[interleave_count];
+    SizeType            pos = header.Position();
+
+    for(SizeType i = 0; i < interleave_count; ++i)
+    {
+        starts[i]   = bitstream + pos;
+        sizes[i]    = (i + 1 < interleave_count) ? std::min(sizes[i], bitstream_len - pos) : bitstream_len - pos;
+        pos        += sizes[i];
+    }
+
+    BitReader reader0(starts[0], sizes[0]);
+    BitReader reader1(starts[1], sizes[1]);
+    BitReader reader2(starts[2], sizes[2]);
+    BitReader reader3(starts[3], sizes[3]);
+
+    SizeType written = 0;
+    bool     damaged = false;
+
+    /** Bits of the entry read, or 0 for a corrupted stream */
+    auto read = [&](BitReader & reader, ByteType & symbol, SizeType & run_len) -> SizeType
+    {
+        const DecodeEntryType & entry = ReadCodeword(table, reader);
+
+        run_len = entry.value;
+        symbol  = entry.symbol;
+
+        if(entry.extra != 0)
+        {
+            run_len += SizeType(reader.Peek(entry.extra));
+            reader.Skip(entry.extra);
+
+            /** The escape of a sampled block has no base length */
+            if(entry.value == 0 && ! ReadEscaped(reader, run_len, symbol, run_len))
+                return SizeType(0);
+        }
+
+        return SizeType(entry.bits);
+    };
+
+    /** False at the end of the output, or of a corrupted stream */
+    auto emit = [&](const SizeType & bits, const ByteType & symbol, SizeType run_len)
+    {
+        if(bits == 0)
+        {
+            damaged = true;
+            return false;
+        }
+
+        run_len = std::min(run_len, out_len - written);
+
+        FillRun(out + written, symbol, run_len, out_len - written);
+        written += run_len;
+
+        return written < out_len;
+    };
+
+    while(written < out_len)
+    {
+        /** A codeword of each bitstream is read before any run is written, so that the four chains overlap */
+        ByteType symbol0, symbol1, symbol2, symbol3;
+        SizeType len0, len1, len2, len3;
+
+        SizeType bits0 = read(reader0, symbol0, len0);
+        SizeType bits1 = read(reader1, symbol1, len1);
+        SizeType bits2 = read(reader2, symbol2, len2);
+        SizeType bits3 = read(reader3, symbol3, len3);
+
+        if(! emit(bits0, symbol0, len0) || ! emit(bits1, symbol1, len1) || ! emit(bits2, symbol2, len2) || ! emit(bits3, symbol3, len3))
+            break;
+
+        /** The bitstreams end within the last four runs; none is read past its end before them */
+        if(reader0.Overrun() > 0 || reader1.Overrun() > 0 || reader2.Overrun() > 0 || reader3.Overrun() > 0)
+            return false;
+    }
+
+    return ! damaged;
+}
+
+bool
+Huffman
+::DecodeContexts(const ByteType * bitstream, const SizeType & bitstream_len, ByteType * out, const SizeType & out_len)
+{
+    PhaseTimer timer(stats_, &StatsType::decode_time);
+
+    /** Lookup tables of each context; the symbol of each run picks the table of the next */
+    const DecodeTableType * tables[ascii_max + 1];
+    for(SizeType context = 0; context <= ascii_max; ++context)
+        tables[context] = &context_tables_[context_map_[context]];
+
+    BitReader reader(bitstream, bitstream_len);
+    ByteType  context = 0;
+
+    for(SizeType written = 0; written < out_len;)
+    {
+        const DecodeEntryType & entry = ReadCodeword(*tables[context], reader);
+
+        SizeType run_len = entry.value;
+
+        if(entry.extra != 0)
+        {
+            run_len += SizeType(reader.Peek(entry.extra));
+            reader.Skip(entry.extra);
+        }
+
+        if(entry.bits == 0 || reader.Overrun() > 0)
+            return false;
+
+        run_len = std::min(run_len, out_len - written);
+
+        FillRun(out + written, entry.symbol, run_len, out_len - written);
+        written += run_len;
+
+        context = entry.symbol;
+    }
+
+    return true;
+}
+
+bool
+Huffman
+::DecodeAdaptive(StreamInType & fin, StreamOutType & fout)
+{
+    PhaseTimer      timer(stats_, &StatsType::decode_time);
+    AdaptiveTree    tree(adaptive_symbol_count);
+    BitReader       reader(fin);
+    BufferedWriter  writer(fout, stream_out_);
+
+    /** Bits are required one field at a time, so that a live stream is not waited on past its last flush */
+    while(true)
+    {
+        /** The tree is walked one bit at a time, as it changes with every run */
+        AdaptiveTree::IndexType pos = tree.Root();
+        while(! tree.IsLeaf(pos))
+        {
+            reader.Require(1);
+            pos = tree.Child(pos, reader.Peek(1) != 0);
+            reader.Skip(1);
+        }
+
+        AdaptiveTree::IndexType index = tree.Symbol(pos);
+
+        if(index == AdaptiveTree::none)
+        {
+            /** Escape; a run not seen yet, a flush, or the end */
+            reader.Require(adaptive_escape_bits);
+            SizeType code = SizeType(reader.Peek(adaptive_escape_bits));
+            reader.Skip(adaptive_escape_bits);
+
+            /** A stream cut short is read past its end before its escape of the end */
+            if(reader.Overrun() > 0)
+                return false;
+
+            if(code == adaptive_end)
+                break;
+
+            /** The runs up to a flush are handed on at once, as the encoder did */
+            if(code == adaptive_flush)
+            {
+                reader.Align();
+                writer.Flush();
+                if(! fout.flush().good())
+                    return false;
+
+                continue;
+            }
+
+            if(code > length_code_max)
+                return false;
+
+            reader.Require(byte_size);
+            index = AdaptiveTree::IndexType(reader.Peek(byte_size) * length_code_max + code - 1);
+            reader.Skip(byte_size);
+        }
+
+        ByteType symbol = ByteType(index / length_code_max);
+        SizeType code   = index % length_code_max + 1;
+        SizeType extra  = LengthExtra(code);
+
+        SizeType run_len = LengthBase(code);
+        if(extra != 0)
+        {
+            reader.Require(extra);
+            run_len += SizeType(reader.Peek(extra));
+            reader.Skip(extra);
+        }
+
+        if(reader.Overrun() > 0)
+            return false;
+
+        tree.Update(index);
+
+        while(run_len > 0)
+        {
+            SizeType len = std::min(run_len, chunk_size);
+            std::memset(writer.Reserve(len), symbol, len);
+
+            run_len -= len;
+        }
+    }
+
+    writer.Flush();
+    return writer.good();
+}
+
+void
+Huffman
+::SetCodewordLengthLimit(const SizeType & limit)
+{
+    codeword_len_limit_ = std::max(SizeType(1), std::min(limit, codeword_len_max));
+}
+
+Huffman
+::SizeType
+Huffman
+::GetCodewordLengthLimit(void)
+const
+{
+    return codeword_len_limit_;
+}
+
+double
+Huffman
+::GetLengthLimitCost(void)
+const
+{
+    if(optimal_bits_ == 0)
+        return 0.0;
+
+    return double(encoded_bits_ - optimal_bits_) / double(optimal_bits_);
+}
+
+void
+Huffman
+::SetBlockSize(const SizeType & block_size)
+{
+    block_size_ = std::max(SizeType(1), block_size);
+}
+
+Huffman
+::SizeType
+Huffman
+::GetBlockSize(void)
+const
+{
+    return block_size_;
+}
+
+void
+Huffman
+::SetThreadCount(const SizeType & thread_count)
+{
+    thread_count_ = thread_count;
+
+    if(thread_count_ == 0)
+        thread_count_ = std::max(1u, std::thread::hardware_concurrency());
+}
+
+Huffman
+::SizeType
+Huffman
+::GetThreadCount(void)
+const
+{
+    return thread_count_;
+}
+
+void
+Huffman
+::SetBlockCacheSize(const SizeType & block_cache_size)
+{
+    block_cache_size_ = block_cache_size;
+
+    while(block_cache_.size() > block_cache_size_)
+        block_cache_.pop_back();
+}
+
+Huffman
+::SizeType
+Huffman
+::GetBlockCacheSize(void)
+const
+{
+    return block_cache_size_;
+}
+
+void
+Huffman
+::ClearBlockCache(void)
+{
+    block_cache_.clear();
+    block_cache_index_.clear();
+}
+
+void
+Huffman
+::SetLengthBuckets(const bool & length_buckets)
+{
+    length_buckets_ = length_buckets;
+}
+
+bool
+Huffman
+::GetLengthBuckets(void)
+const
+{
+    return length_buckets_;
+}
+
+void
+Huffman
+::SetAdaptive(const bool & adaptive)
+{
+    adaptive_ = adaptive;
+}
+
+bool
+Huffman
+::GetAdaptive(void)
+const
+{
+    return adaptive_;
+}
+
+void
+Huffman
+::SetStats(StatsType * stats)
+{
+    stats_ = stats;
+}
+
+Huffman
+::StatsType *
+Huffman
+::GetStats(void)
+const
+{
+    return stats_;
+}
+
+void
+Huffman
+::SetInterleaved(const bool & interleaved)
+{
+    interleaved_ = interleaved;
+}
+
+bool
+Huffman
+::GetInterleaved(void)
+const
+{
+    return interleaved_;
+}
+
+void
+Huffman
+::SetSampleStride(const SizeType & sample_stride)
+{
+    sample_stride_ = std::max(SizeType(1), sample_stride);
+}
+
+Huffman
+::SizeType
+Huffman
+::GetSampleStride(void)
+const
+{
+    return sample_stride_;
+}
+
+void
+Huffman
+::SetContexts(const bool & contexts)
+{
+    contexts_ = contexts;
+}
+
+bool
+Huffman
+::GetContexts(void)
+const
+{
+    return contexts_;
+}
+
+void
+Huffman
+::SetPipelined(const bool & pipelined)
+{
+    pipelined_ = pipelined;
+}
+
+bool
+Huffman
+::GetPipelined(void)
+const
+{
+    return pipelined_;
+}
+
+struct AdaptiveEncoder::State
+{
+    StreamOutType *         fout;
+    AdaptiveTree            tree;
+    std::vector<ByteType>   buffer;         /**< Bitstream, handed to fout when a chunk is full */
+    BitWriter               writer;
+
+    SizeType                written;        /**< Bytes handed to fout */
+
+    ByteType                symbol;         /**< Run not ended yet; the next byte may go on with it */
+    SizeType                run_len;
+    bool                    closed;
+
+    State(StreamOutType & fout)
+    : fout          (&fout)
+    , tree          (Huffman::adaptive_symbol_count)
+    , buffer        (Huffman::chunk_size * 2 + BitWriter::slack)
+    , writer        (buffer.data())
+    , written       (0)
+    , symbol        (0)
+    , run_len       (0)
+    , closed        (false)
+    { }
+};
+
+AdaptiveEncoder
+::AdaptiveEncoder(StreamOutType & fout)
+: state_    (new State(fout))
+{
+    BinaryStream::Write<uint32_t>(fout, Huffman::magic | Huffman::adaptive_version);
+    state_->written = sizeof(uint32_t);
+}
+
+AdaptiveEncoder
+::~AdaptiveEncoder(void)
+{
+    Close();
+}
+
+bool
+AdaptiveEncoder
+::Write(const ByteType * in, const SizeType & in_len)
+{
+    State & state = *state_;
+
+    if(state.closed)
+        return false;
+
+    /** The last run of the input is held, as the next input may go on with it */
+    RunScanner::Scan(in, in_len, [&](const ByteType & symbol, const SizeType & run_len)
+    {
+        if(state.run_len > 0 && symbol == state.symbol)
+        {
+            state.run_len += run_len;
+            return true;
+        }
+
+        EmitRun(state.symbol, state.run_len);
+
+        state.symbol    = symbol;
+        state.run_len   = run_len;
+
+        return true;
+    });
+
+    return state.fout->good();
+}
+
+bool
+AdaptiveEncoder
+::Flush(void)
+{
+    State & state = *state_;
+
+    if(state.closed)
+        return false;
+
+    EmitRun(state.symbol, state.run_len);
+    state.run_len = 0;
+
+    EmitEscape(Huffman::adaptive_flush);
+    state.fout->flush();
+
+    return state.fout->good();
+}
+
+bool
+AdaptiveEncoder
+::Close(void)
+{
+    State & state = *state_;
+
+    if(state.closed)
+        return state.fout->good();
+
+    EmitRun(state.symbol, state.run_len);
+    state.run_len = 0;
+
+    EmitEscape(Huffman::adaptive_end);
+    state.closed = true;
+
+    return state.fout->good();
+}
+
+void
+AdaptiveEncoder
+::EmitRun(const ByteType & symbol, SizeType run_len)
+{
+    State & state = *state_;
+
+    /** Longer runs are split, as in the bucketed blocks */
+    while(run_len > 0)
+    {
+        SizeType len    = std::min(run_len, Huffman::length_run_max);
+        SizeType code   = LengthCode(len);
+
+        AdaptiveTree::IndexType     index = AdaptiveTree::IndexType(symbol * Huffman::length_code_max + code - 1);
+        AdaptiveTree::CodewordType  codeword;
+        SizeType                    codeword_len = state.tree.GetCodeword(index, codeword);
+
+        state.writer.Put(codeword, codeword_len);
+
+        if(! state.tree.IsSeen(index))
+        {
+            state.writer.Put(code, Huffman::adaptive_escape_bits);
+            state.writer.Put(symbol, Huffman::byte_size);
+        }
+
+        state.writer.Put(len - LengthBase(code), LengthExtra(code));
+        state.tree.Update(index);
+
+        if(state.writer.Size(state.buffer.data()) >= Huffman::chunk_size)
+            Drain();
+
+        run_len -= len;
+    }
+}
+
+void
+AdaptiveEncoder
+::EmitEscape(const SizeType & code)
+{
+    State & state = *state_;
+
+    AdaptiveTree::CodewordType  codeword;
+    SizeType                    codeword_len = state.tree.GetCodeword(AdaptiveTree::none, codeword);
+
+    state.writer.Put(codeword, codeword_len);
+    state.writer.Put(code, Huffman::adaptive_escape_bits);
+    state.writer.Align();
+
+    Drain();
+}
+
+void
+AdaptiveEncoder
+::Drain(void)
+{
+    State & state = *state_;
+
+    SizeType len = state.writer.Drain(state.buffer.data());
+    state.fout->write((char *)state.buffer.data(), std::streamsize(len));
+
+    state.written += len;
+}
+
+AdaptiveEncoder
+::SizeType
+AdaptiveEncoder
+::Size(void)
+const
+{
+    return state_->written;
 }
@@ -1,13 +1,28 @@
 #ifndef ALGORITHM_HUFFMAN_H_
 #define ALGORITHM_HUFFMAN_H_ 1
 
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
 #include <vector>
 #include <array>
+#include <list>
+#include <memory>
+#include <unordered_map>
 #include <limits>
+#include <algorithm>
 
 namespace algorithm
 {
 
+class BufferedWriter;
+class BitWriter;
+class Codebook;
+class AdaptiveEncoder;
+template<typename T> class BoundedQueue;
+
 /** \brief  Modified Huffman coding
 
     Huffman coding method with Run Length Encoding.
@@ -36,6 +51,52 @@ public:
 
     static  const SizeType  byte_size   = 8;                /**< 8 bits, bit size of ByteType */
     static  const SizeType  buffer_size = byte_size * 4;    /**< Bit size of CodewordType */
+    static  const SizeType  lookup_bits = 11;               /**< Index width of the first level decode table */
+    static  const SizeType  codeword_len_max = buffer_size; /**< Longest codeword that fits in CodewordType */
+    static  const SizeType  chunk_size  = 1 << 16;          /**< Bytes buffered before writing to the output */
+
+    /** File format */
+    static  const uint32_t  magic           = 0x48554600;   /**< "HUF", followed by a byte of format version */
+    static  const ByteType  legacy_version      = 0;        /**< Headerless format, with the frequency of each run */
+    static  const ByteType  unframed_version    = 1;        /**< Canonical codes for the whole input, sized up front */
+    static  const ByteType  framed_version      = 2;        /**< Canonical codes for each block, framed by its length */
+    static  const ByteType  format_version      = 3;        /**< Each block leads with a byte of flags */
+    static  const ByteType  codebook_version    = 4;        /**< One bitstream, coded with a codebook named by its ID */
+    static  const ByteType  adaptive_version    = 5;        /**< One bitstream of adaptive codes, ended by an escape */
+
+    static  const ByteType  block_bucketed      = 0x01;     /**< Block flag; run lengths are coded as length codes and extra bits */
+    static  const ByteType  block_interleaved   = 0x02;     /**< Block flag; the codewords are dealt to interleave_count bitstreams in turn */
+    static  const ByteType  block_stored        = 0x04;     /**< Block flag; the bytes of the block follow as they are, for coding would not shrink them */
+    static  const ByteType  block_sampled       = 0x08;     /**< Block flag; the code was built from a sample of the block, and the runs missing from it are escaped */
+    static  const ByteType  block_contexts      = 0x10;     /**< Block flag; each run is coded with the table of the symbol of the run before it */
+
+    static  const SizeType  interleave_count    = 4;        /**< Bitstreams of an interleaved block; the sizes of all but the last lead them */
+
+    static  const SizeType  length_extra_max    = 21;                           /**< Most extra bits of a length code */
+    static  const SizeType  length_code_max     = 8 + 4 * length_extra_max;     /**< Length codes of each symbol */
+    static  const SizeType  length_run_max      = SizeType(1) << (length_extra_max + 3);   /**< Longest run of a length code; longer runs are split */
+    static  const SizeType  run_len_max         = std::numeric_limits<uint32_t>::max();     /**< Longest run of the other blocks, as the decoder keeps it; longer runs are split */
+
+    static  const SizeType  block_size_default  = 1 << 20;  /**< Bytes of input coded as one block */
+
+    static  const SizeType  sample_chunk        = 1 << 14;              /**< Bytes of each chunk of a sampled block; one in each stride is counted */
+    static  const SizeType  sample_escape       = length_code_max + 1;  /**< Length code of the escape of a sampled block; a symbol and a length code follow it */
+
+    static  const SizeType  context_table_max   = 16;       /**< Tables of a block with contexts; the first is shared by the contexts without one of their own */
+
+    static  const uint32_t  index_magic         = 0x48554649;   /**< "HUFI", ends the block index */
+    static  const SizeType  index_footer_size   = 12;           /**< uint64_t size of the index, and index_magic */
+
+    static  const SizeType  block_cache_default = 8;            /**< Decoded blocks kept by DecompressRange */
+    static  const SizeType  pipeline_slots      = 4;            /**< Blocks held by a pipelined compression; read ahead, being coded, and being written */
+
+    static  const uint32_t  codebook_magic      = 0x48554643;   /**< "HUFC", starts a codebook file */
+    static  const SizeType  codebook_weight     = 256;          /**< Weight of a run seen in training, against 1 for the runs not seen */
+
+    static  const SizeType  adaptive_symbol_count   = (ascii_max + 1) * length_code_max;  /**< (symbol, length code) of the adaptive codes */
+    static  const SizeType  adaptive_escape_bits    = 7;        /**< Length code after the escape of a run not seen yet */
+    static  const SizeType  adaptive_end            = 0;        /**< Escaped length code that ends the stream */
+    static  const SizeType  adaptive_flush          = 127;      /**< Escaped length code of a flush; the bitstream goes on from the next byte */
 
     /** Class for each node in Huffman tree, and used in RLE */
     struct Run
@@ -189,32 +250,485 @@ public:
         { return ! operator<(rhs); }
     };
 
+    /** Entry of the table-driven decoder
+
+        The first level is indexed by the next `lookup_bits' bits of the
+        bitstream, and resolves a whole codeword at once.
+        Longer codewords continue through a sub-table, which is indexed by
+        the following `sub_bits' bits.
+    */
+    struct DecodeEntry
+    {
+        uint32_t        value;          /**< Run-length of the leaf, or offset of the sub-table */
+        ByteType        symbol;         /**< ASCII character of the leaf */
+        uint8_t         bits;           /**< Bits consumed on this level */
+        uint8_t         sub_bits;       /**< Index width of the sub-table, 0 for a leaf */
+        uint8_t         extra;          /**< Extra bits added to the run-length, in bucketed blocks */
+
+        DecodeEntry(void)
+        : value         (0)
+        , symbol        (0)
+        , bits          (0)
+        , sub_bits      (0)
+        , extra         (0)
+        { }
+    };
+
+    /** Entry of the encode table, indexed by (symbol, run_len) of the short runs */
+    struct EncodeEntry
+    {
+        CodewordType    codeword;       /**< Canonical codeword of the run */
+        uint8_t         codeword_len;   /**< Length of member `codeword', 0 for a run not in the block */
+
+        EncodeEntry(void)
+        : codeword      (0)
+        , codeword_len  (0)
+        { }
+    };
+
     typedef Run                     RunType;
 
     typedef std::vector<RunType>    RunArrayType;
     typedef RunType *               HuffmanTreeType;
     typedef std::array<RunType *, ascii_max + 1>    RunListType;
 
+    typedef DecodeEntry                 DecodeEntryType;
+    typedef std::vector<DecodeEntry>    DecodeTableType;
+
+    typedef EncodeEntry                 EncodeEntryType;
+    typedef std::vector<EncodeEntry>    EncodeTableType;
+
+    /** Position of a block, in the compressed and the uncompressed stream */
+    struct IndexEntry
+    {
+        SizeType        offset;         /**< Offset of the block from the start of the compressed stream */
+        SizeType        size;           /**< Bytes of the block, with its header */
+        SizeType        raw_offset;     /**< Offset of the block from the start of the uncompressed stream */
+        SizeType        raw_size;       /**< Bytes of input coded in the block */
+
+        inline
+        bool
+        operator==(const IndexEntry & rhs)
+        const
+        {
+            return offset == rhs.offset && size == rhs.size
+                && raw_offset == rhs.raw_offset && raw_size == rhs.raw_size;
+        }
+
+        inline
+        bool
+        operator!=(const IndexEntry & rhs)
+        const
+        { return ! (*this == rhs); }
+    };
+
+    typedef IndexEntry                  IndexEntryType;
+    typedef std::vector<IndexEntry>     IndexType;
+
+    typedef std::vector<ByteType>                   BlockType;
+    typedef std::pair<SizeType, BlockType>          CachedBlockType;    /**< Number of the block, and its bytes */
+    typedef std::list<CachedBlockType>              BlockCacheType;
+
+    /** What the coder did, added up over the streams it coded while it was set with SetStats.
+        Times are wall-clock seconds of each phase, summed over the blocks, and the threads coding them;
+        sizes, runs and codewords are of compression.
+    */
+    struct Stats
+    {
+        double          collect_runs_time;  /**< Counting the runs of the input */
+        double          create_tree_time;   /**< Huffman tree, length limit, and canonical codewords */
+        double          header_time;        /**< Run tables, written or read */
+        double          encode_time;        /**< Encode table, and bitstreams of the encoder */
+        double          decode_time;        /**< Bitstreams of the decoder */
+
+        SizeType        bytes_in;           /**< Bytes of input compressed */
+        SizeType        bytes_out;          /**< Bytes of compressed output */
+        SizeType        run_count;          /**< Runs coded; runs beyond the last length code count once for each piece, and sampled blocks not at all */
+        SizeType        meta_symbol_count;  /**< Distinct meta-symbols of the block with the most of them */
+        SizeType        codeword_len_max;   /**< Longest codeword of any block */
+        SizeType        codeword_bits;      /**< Bits of the codewords, without the extra bits of length codes, nor sampled blocks */
+        SizeType        optimal_codeword_bits;  /**< Bits of the same codewords, had their lengths not been limited */
+        SizeType        stored_block_count; /**< Blocks stored as they are, and not counted above */
+
+        Stats(void)
+        : collect_runs_time (0)
+        , create_tree_time  (0)
+        , header_time       (0)
+        , encode_time       (0)
+        , decode_time       (0)
+        , bytes_in          (0)
+        , bytes_out         (0)
+        , run_count         (0)
+        , meta_symbol_count (0)
+        , codeword_len_max  (0)
+        , codeword_bits     (0)
+        , optimal_codeword_bits (0)
+        , stored_block_count(0)
+        { }
+
+        inline
+        double
+        AverageCodewordLength(void)
+        const
+        { return run_count > 0 ? double(codeword_bits) / double(run_count) : 0.0; }
+
+        /** Growth of the codewords caused by the limit of their length; 0.01 is 1% larger */
+        inline
+        double
+        LengthLimitCost(void)
+        const
+        { return optimal_codeword_bits > 0 ? double(codeword_bits - optimal_codeword_bits) / double(optimal_codeword_bits) : 0.0; }
+
+        inline
+        Stats &
+        operator+=(const Stats & rhs)
+        {
+            collect_runs_time   += rhs.collect_runs_time;
+            create_tree_time    += rhs.create_tree_time;
+            header_time         += rhs.header_time;
+            encode_time         += rhs.encode_time;
+            decode_time         += rhs.decode_time;
+
+            bytes_in            += rhs.bytes_in;
+            bytes_out           += rhs.bytes_out;
+            run_count           += rhs.run_count;
+            meta_symbol_count   = std::max(meta_symbol_count, rhs.meta_symbol_count);
+            codeword_len_max    = std::max(codeword_len_max, rhs.codeword_len_max);
+            codeword_bits       += rhs.codeword_bits;
+            optimal_codeword_bits   += rhs.optimal_codeword_bits;
+            stored_block_count  += rhs.stored_block_count;
+
+            return *this;
+        }
+    };
+
+    typedef Stats                       StatsType;
+
 private:
     /** Member data */
     RunArrayType        runs_;      /** Set of runs */
-    RunListType         list_;      /** ArrayList of runs, for symbol searching efficiency */
+    RunListType         list_;      /** ArrayList of the runs too long for encode_table_ */
+    EncodeTableType     encode_table_;  /** Codewords of the short runs, by (symbol, run_len) */
     HuffmanTreeType     root_;      /** Root node of the Huffman tree */
+    DecodeTableType     table_;     /** Lookup tables of the decoder */
+
+    /** Scratch of the coder; cleared for each block, and kept allocated until the coder is gone */
+    RunArrayType        nodes_;                 /** Nodes of the Huffman tree, root_ among them */
+    RunArrayType        heap_;                  /** Storage of the heap building the tree */
+    std::vector<uint32_t>                   direct_;    /** Positions in runs_ of the short runs, by (symbol, run_len) */
+    std::unordered_map<uint64_t, uint32_t>  hashed_;    /** Positions in runs_ of the long runs */
+    std::vector<RunType *>                  leaves_;    /** Leaves handed to FillDecodeTable */
+    std::vector<ByteType>                   block_in_;  /** Block read from the input stream */
+    std::vector<ByteType>                   streams_;   /** Bitstreams of an interleaved or sampled block, before they are put together */
+    std::unique_ptr<BufferedWriter>         block_out_; /** Block, or index, being written */
+    std::vector<ByteType>                   stream_out_;    /** Buffer of the writer of a whole stream, lent to it by each call */
+    std::vector<SizeType>                   pairs_;     /** Runs of each symbol after each symbol, by (context, symbol) */
+    std::vector<RunArrayType>               context_runs_;      /** Runs of each table of a block with contexts */
+    EncodeTableType                         context_encode_;    /** Codewords of each table, by (table, symbol, length code) */
+    std::vector<DecodeTableType>            context_tables_;    /** Lookup tables of the decoder, one for each table */
+    std::array<ByteType, ascii_max + 1>     context_map_;       /** Table of each context */
+    std::vector<std::unique_ptr<Huffman> >  workers_;           /** Coders of the worker threads, one for each */
+    IndexType           index_;                 /** Blocks of the stream being compressed */
+
+    SizeType            block_size_;            /** Bytes buffered and coded as one block */
+    SizeType            thread_count_;          /** Threads coding blocks at once */
+    SizeType            codeword_len_limit_;    /** Longest codeword the encoder may assign */
+    bool                length_buckets_;        /** Code the run lengths of the blocks as length codes and extra bits */
+    bool                interleaved_;           /** Deal the codewords of the blocks to interleave_count bitstreams */
+    SizeType            sample_stride_;         /** Build the code of a block from one in this many of its chunks */
+    bool                contexts_;              /** Code the runs of the blocks with a table for each symbol before them */
+    bool                pipelined_;             /** Read and write the blocks on threads of their own, while they are coded */
+    bool                adaptive_;              /** Compress in one pass, with adaptive codes */
+    ByteType            block_flags_;           /** Flags of the block being coded */
+    BlockCacheType      block_cache_;           /** Blocks decoded by DecompressRange, the most recent first */
+    IndexType           block_cache_index_;     /** Index of the stream the cached blocks belong to */
+    SizeType            block_cache_size_;      /** Blocks kept in block_cache_ */
+
+    StatsType *         stats_;                 /** Phase times are added to it; nullptr to time nothing */
+
+    SizeType            optimal_bits_;          /** Bits of the tables written by the last compression, with unlimited codeword lengths */
+    SizeType            encoded_bits_;          /** Bits of the same tables, with the limited codeword lengths */
 
     /** Member functions */
-    void CollectRuns(StreamInType &);
+    bool CompressStream(StreamInType *, const ByteType *, const SizeType &, StreamOutType &);
+    void CompressFramed(StreamInType *, const ByteType *, const SizeType &, BufferedWriter &);
+    void CompressBlocks(StreamInType *, const ByteType *, const SizeType &, BufferedWriter &, IndexType &);
+    void LendWorkers(BoundedQueue<Huffman *> &);
+    void CompressBlock(const ByteType *, const SizeType &, BufferedWriter &);
+    void StoreBlock(const ByteType *, const SizeType &, BufferedWriter &);
+    template<SizeType STREAMS> bool EncodeSampled(const ByteType *, const SizeType &, const SizeType &, ByteType *, const SizeType &, SizeType *);
+    bool CompressContexts(const ByteType *, const SizeType &, BufferedWriter &);
+    bool EncodeContexts(const ByteType *, const SizeType &, BitWriter &);
+    bool DecompressStream(StreamInType &, StreamOutType &, const Codebook *);
+    bool DecompressMemory(const ByteType *, const SizeType &, ByteType *, const SizeType &, const Codebook *);
+    bool DecompressBlocks(StreamInType &, StreamOutType &, const IndexType &, const ByteType &);
+    bool DecompressBlock(const ByteType *, const SizeType &, ByteType *, const SizeType &, const ByteType &);
+    SizeType CollectRuns(const ByteType *, const SizeType &, const SizeType &);
     void CreateHuffmanTree(void);
-    void CreateRunList(RunType *);
+    void DeleteHuffmanTree(void);
+    void CreateEncodeTable(void);
     void AssignCodeword(RunType *, const CodewordType & = 0, const SizeType & = 0);
+    SizeType LimitCodewordLength(SizeType &);
+    void AssignCanonicalCodeword(void);
     SizeType GetCodeword(CodewordType &, const ByteType &, const SizeType &);
-    void Encode(StreamInType &, StreamOutType &);
-    void Decode(StreamInType &, StreamOutType &, const SizeType &);
-    void WriteHeader(StreamInType &, StreamOutType &);
-    SizeType ReadHeader(StreamInType &);
+    void CreateDecodeTable(void);
+    void FillDecodeTable(const SizeType &, const SizeType &, const SizeType &, const std::vector<RunType *> &);
+    template<SizeType STREAMS> bool Encode(const EncodeTableType &, const ByteType &, const ByteType *, const SizeType &, BitWriter *, SizeType &);
+    bool Decode(StreamInType &, StreamOutType &, const SizeType &);
+    bool DecodeBlock(const DecodeTableType &, const ByteType &, const ByteType *, const SizeType &, ByteType *, const SizeType &);
+    bool DecodeInterleaved(const DecodeTableType &, const ByteType *, const SizeType &, ByteType *, const SizeType &);
+    bool DecodeContexts(const ByteType *, const SizeType &, ByteType *, const SizeType &);
+    bool DecodeAdaptive(StreamInType &, StreamOutType &);
+    void WriteHeader(BufferedWriter &);
+    bool ReadHeader(StreamInType &, ByteType &, SizeType &);
+    void WriteRunTable(BufferedWriter &);
+    template<typename STREAM_IN> bool ReadBlockFlags(STREAM_IN &, const ByteType &);
+    template<typename STREAM_IN> bool ReadRunTable(STREAM_IN &);
+    template<typename STREAM_IN> bool ReadContextTables(STREAM_IN &, const bool &);
+    void WriteIndex(BufferedWriter &, const IndexType &);
+    bool ReadIndex(StreamInType &, IndexType &);
+    bool ScanIndex(StreamInType &, IndexType &, const ByteType &);
+    const BlockType * GetBlock(StreamInType &, const IndexType &, const SizeType &, const ByteType &);
+    bool BuildCodebook(Codebook &);
+
+public:
+    Huffman(void);
+    ~Huffman(void);
+
+    /** Drop the state of the last stream, and keep the memory for the next one.
+        Settings stay as they are; a coder reused over many small inputs allocates almost nothing.
+    */
+    void Reset(void);
+
+    /** Each of Compress and Decompress returns false when it fails; the output is not whole then.
+        Decompress fails for an input that is truncated, damaged, of an unknown format version,
+        or compressed with a codebook other than the one given.
+    */
+    bool Compress(StreamInType &, StreamOutType &);
+    bool Decompress(StreamInType &, StreamOutType &);
+
+    /** Compress a range of memory, such as a mapped file; the blocks are coded in place */
+    bool Compress(const ByteType *, const SizeType &, StreamOutType &);
+
+    /** Decompress a range of memory into memory of exactly the uncompressed size.
+        Returns false when the input is not understood, or out is of another size.
+    */
+    bool Decompress(const ByteType *, const SizeType &, ByteType *, const SizeType &);
+
+    /** Compress a range of memory into memory of `out_len' bytes, and return the bytes written;
+        0 when they do not fit. A buffer of CompressBound bytes always fits them.
+        With one thread the blocks are coded into `out' in place, pipelined or not; the blocks
+        of worker threads, and an adaptive stream, are coded into buffers first, and copied in.
+    */
+    SizeType Compress(const ByteType *, const SizeType &, ByteType *, const SizeType &);
+
+    /** Most bytes Compress writes for an input of `in_len' bytes, with the settings of this coder */
+    SizeType CompressBound(const SizeType &) const;
+
+    /** Train a codebook on samples of the inputs it is meant for.
+        Every run of every symbol gets a codeword, so that the codebook codes any input;
+        run lengths are coded as length codes, as with SetLengthBuckets.
+    */
+    void Train(const std::vector<std::pair<const ByteType *, SizeType> > &, Codebook &);
+
+    /** Codebook files; ReadCodebook returns false for a file that is not understood, or damaged,
+        and WriteCodebook for a codebook not trained
+    */
+    bool WriteCodebook(StreamOutType &, const Codebook &);
+    bool ReadCodebook(StreamInType &, Codebook &);
+
+    /** Compress with a codebook, as one bitstream behind a header of a few bytes.
+        No runs are collected and no table is written; made for small inputs,
+        as the whole input is coded at once. An input the codebook would not shrink
+        is compressed as usual instead. Fails for a codebook not trained.
+    */
+    bool Compress(StreamInType &, StreamOutType &, const Codebook &);
+    bool Compress(const ByteType *, const SizeType &, StreamOutType &, const Codebook &);
+    SizeType Compress(const ByteType *, const SizeType &, ByteType *, const SizeType &, const Codebook &);
+    SizeType CompressBound(const SizeType &, const Codebook &) const;
+
+    /** Decompress with the codebook the input was compressed with;
+        input compressed without a codebook is decompressed as usual
+    */
+    bool Decompress(StreamInType &, StreamOutType &, const Codebook &);
+    bool Decompress(const ByteType *, const SizeType &, ByteType *, const SizeType &, const Codebook &);
+
+    /** Uncompressed size of a compressed range of memory; from the header, or the block index.
+        Memory of that size is what Decompress decodes into, with no copy in between.
+    */
+    bool GetDecompressedSize(const ByteType *, const SizeType &, SizeType &);
+
+    /** Decompress `length' bytes from `offset' of the uncompressed stream; fewer past its end.
+        Only the blocks covering the range are decoded, from a seekable input; an input that cannot be
+        seeked, such as a pipe, or one of a format without blocks, is decoded from its start, and only the range written.
+        False when the input is not understood, or a block of the range is damaged.
+    */
+    bool DecompressRange(StreamInType &, const SizeType &, const SizeType &, StreamOutType &);
+
+    /** Decoded blocks kept for DecompressRange, so that nearby reads skip decoding.
+        The cache is dropped when a stream with another block index is read.
+    */
+    void SetBlockCacheSize(const SizeType &);
+    SizeType GetBlockCacheSize(void) const;
+    void ClearBlockCache(void);
+
+    /** Bytes of input coded as one block with its own table; memory use of Compress is bounded by it */
+    void SetBlockSize(const SizeType &);
+    SizeType GetBlockSize(void) const;
+
+    /** Threads coding blocks at once; 0 is one for each core.
+        The output does not depend on the number of threads.
+        Decompress runs in parallel when the input is seekable, and ends with a block index.
+    */
+    void SetThreadCount(const SizeType &);
+    SizeType GetThreadCount(void) const;
+
+    /** Longest codeword the encoder may assign, up to `codeword_len_max'.
+        The limit is raised for the runs to fit, if there are more than 2^limit of them.
+    */
+    void SetCodewordLengthLimit(const SizeType &);
+    SizeType GetCodewordLengthLimit(void) const;
+
+    /** Code run lengths as DEFLATE style length codes, followed by the exact length in extra bits.
+        The alphabet is then bounded by 256 x length_code_max, however varied the run lengths are.
+    */
+    void SetLengthBuckets(const bool &);
+    bool GetLengthBuckets(void) const;
+
+    /** Deal the codewords of each block to interleave_count bitstreams in turn, each with a bit reader of its own,
+        so that the decoder follows several chains of codewords at once; a few bytes larger for each block
+    */
+    void SetInterleaved(const bool &);
+    bool GetInterleaved(void) const;
+
+    /** Build the code of each block from one in `stride' of its chunks of sample_chunk bytes, and escape the runs
+        missing from them; the runs are counted in a fraction of the time, for a somewhat larger output.
+        Run lengths are coded as length codes then, as with SetLengthBuckets. 1, the default, counts every run.
+    */
+    void SetSampleStride(const SizeType &);
+    SizeType GetSampleStride(void) const;
+
+    /** Code the runs of each block with a table for the symbol of the run before them, for the symbols
+        whose next runs differ enough from the rest; the other symbols share one table, and up to
+        context_table_max tables are sent. Made for records, where a byte says much about the next one;
+        a block the tables would not shrink is coded as usual. Run lengths are coded as length codes then,
+        as with SetLengthBuckets, and the blocks with tables are neither interleaved nor sampled;
+        a block coded as usual instead is, as SetInterleaved and SetSampleStride have it.
+    */
+    void SetContexts(const bool &);
+    bool GetContexts(void) const;
+
+    /** Read the blocks on a thread of its own, and write the coded ones on another, so that the device is busy
+        while the blocks are coded by one thread; a mapped input is touched ahead of the coder, page by page.
+        Up to pipeline_slots blocks are held at once. Made for large inputs; the threads are started for each stream.
+        With more than one thread, the coding threads overlap the reading already, and the coded blocks
+        are written by a thread of their own. A memory-to-memory Compress is coded in place, and not pipelined.
+        What a stage throws is thrown by the call, once the other stages are stopped and joined.
+    */
+    void SetPipelined(const bool &);
+    bool GetPipelined(void) const;
+
+    /** Compress in one pass with adaptive Huffman codes, which are updated after each run.
+        No table is sent and no block is buffered; made for streams, see AdaptiveEncoder.
+        The other settings do not apply then.
+    */
+    void SetAdaptive(const bool &);
+    bool GetAdaptive(void) const;
+
+    /** Add what the coder does to `stats', until it is set to nullptr, the default;
+        nothing is timed or counted then. Reset leaves it as it is.
+    */
+    void SetStats(StatsType *);
+    StatsType * GetStats(void) const;
+
+    /** Growth of the last compressed bitstream caused by the limit,
+        against optimal Huffman codes; 0.01 is 1% larger.
+        Only the tables that are written count; not those of stored blocks, those only measured, nor Train
+    */
+    double GetLengthLimitCost(void) const;
+};
+
+/** \brief  Codebook trained beforehand, shared by the coders of many small inputs
+
+    Made by Huffman::Train, or Huffman::ReadCodebook, and not changed afterwards;
+    one codebook can be used by many coders at once.
+*/
+class Codebook
+{
+    friend class Huffman;
+
+public:
+    typedef Huffman::SizeType           SizeType;
+    typedef Huffman::ByteType           ByteType;
 
+private:
+    uint32_t                    id_;                /**< Hash of data_, written in the header of the streams */
+    std::vector<ByteType>       data_;              /**< Flags, and run table, as in the codebook file */
+    ByteType                    flags_;             /**< Block flags the codes are made for */
+    SizeType                    codeword_len_max_;  /**< Longest codeword */
+    Huffman::EncodeTableType    encode_table_;
+    Huffman::DecodeTableType    decode_table_;
+
+public:
+    Codebook(void)
+    : id_               (0)
+    , flags_            (0)
+    , codeword_len_max_ (0)
+    { }
+
+    uint32_t
+    GetId(void)
+    const
+    { return id_; }
+
+    /** True before the codebook is trained, or read */
+    bool
+    empty(void)
+    const
+    { return data_.empty(); }
+};
+
+/** \brief  One-pass encoder of adaptive Huffman codes, for live streams
+
+    Each run is coded as soon as the next byte ends it, with codes of the
+    FGK algorithm over (symbol, length code); the decoder updates the same
+    tree as it goes, so no table is sent and nothing waits for a block.
+    Flush() sends the runs written so far; it costs a few bits, and a
+    run is cut by it. Huffman::Decompress reads the stream.
+*/
+class AdaptiveEncoder
+{
 public:
-    void Compress(StreamInType &, StreamOutType &);
-    void Decompress(StreamInType &, StreamOutType &);
+    typedef Huffman::SizeType           SizeType;
+    typedef Huffman::ByteType           ByteType;
+    typedef Huffman::StreamOutType      StreamOutType;
+
+private:
+    struct State;
+    std::unique_ptr<State>  state_;
+
+    void EmitRun(const ByteType &, SizeType);
+    void EmitEscape(const SizeType &);
+    void Drain(void);
+
+public:
+    /** Writes the header to fout */
+    AdaptiveEncoder(StreamOutType &);
+
+    /** Closes the stream, if it is not yet */
+    ~AdaptiveEncoder(void);
+
+    /** False once the stream is closed, or fout has failed */
+    bool Write(const ByteType *, const SizeType &);
+
+    /** Code the pending run, pad to a whole byte, and flush fout */
+    bool Flush(void);
+
+    /** End the stream; nothing is written afterwards */
+    bool Close(void);
+
+    /** Bytes written to fout so far, the header included */
+    SizeType Size(void) const;
 };
 
 } /** ns: algorithm */